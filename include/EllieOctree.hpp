@@ -7,6 +7,26 @@
 #include <utility>
 #include <type_traits>
 #include <concepts>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <bit>
+#include <string>
+#include <limits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#define OCTREE_MMAP
+#endif
 
 // Concepts
 template<typename Tname>
@@ -21,6 +41,127 @@ concept moveable = std::is_move_constructible_v<Tname>;
 template<typename Tname>
 concept moveableOnly = std::is_move_constructible_v<Tname> && !std::is_copy_constructible_v<Tname>;
 
+template<typename Tname>
+concept triviallyCopyable = std::is_trivially_copyable_v<Tname>;
+
+// Object transfer, moving where possible and copying otherwise
+template<copyableOnly Tname> void transferObj(Tname& dest, Tname& src) { dest = src; }
+template<moveable Tname> void transferObj(Tname& dest, Tname& src) { dest = std::move(src); }
+
+// Runs task(i) for i in [0, count) over a pool of threads (numThreads <= 0 uses all hardware threads)
+template<typename F> void parallelFor(int count, int numThreads, F&& task) {
+	if (numThreads <= 0) { numThreads = std::max(1, (int)std::thread::hardware_concurrency()); }
+	numThreads = std::min(numThreads, count);
+	if (numThreads <= 1) {  // serial case
+		for (int i = 0; i < count; i++) { task(i); }
+		return;
+	}
+	std::atomic<int> next(0);
+	auto worker = [&]() {
+		for (int i = next++; i < count; i = next++) { task(i); }
+	};
+	std::vector<std::thread> pool;
+	for (int t = 1; t < numThreads; t++) { pool.emplace_back(worker); }
+	worker();  // calling thread works too
+	for (std::thread& th : pool) { th.join(); }
+}
+
+// Permutes arr in place so that arr[i] becomes the old arr[order[i]], following cycles
+template<typename Tname> void applyOrder(const std::vector<uint32_t>& order, Tname* arr) {
+	std::vector<bool> done(order.size(), false);
+	for (size_t i = 0; i < order.size(); i++) {
+		if (done[i] || order[i] == i) { continue; }
+		Tname held;
+		transferObj(held, arr[i]);  // first element of the cycle
+		size_t j = i;
+		while (order[j] != i) {
+			transferObj(arr[j], arr[order[j]]);
+			done[j] = true;
+			j = order[j];
+		}
+		transferObj(arr[j], held);
+		done[j] = true;
+	}
+}
+
+// Instrumentation policies, passed as the second Octree template parameter
+enum class OctreeCounter {
+	NodesVisited,  // nodes stepped through by queries, updates and walks
+	CoordCalls,  // calls to the object to coordinate function
+	Allocations,  // nodes and object arrays allocated
+	ObjCopies, ObjMoves,  // objects copied or moved between arrays
+	Splits, Collapses,  // leaves split and internal nodes collapsed by updates
+	Migrated, Lost,  // objects moved to another leaf or out of the tree by updates
+	TreeCopies, TreeMoves,  // Octree copy/move constructors and assignments
+	Count
+};
+
+struct NoInstrumentation {  // Default policy, every hook is empty and compiles away
+	static constexpr bool enabled = false;
+	static void count(OctreeCounter, uint64_t = 1) {}
+};
+
+struct CountingInstrumentation {  // Thread-local counters, summed over all threads on demand
+	static constexpr bool enabled = true;
+	struct Counts {
+		uint64_t values_[(int)OctreeCounter::Count] = {};
+		uint64_t operator[](OctreeCounter c) const { return values_[(int)c]; }
+	};
+
+	static void count(OctreeCounter c, uint64_t n = 1) {
+		std::atomic<uint64_t>& value = local().values_[(int)c];
+		value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);  // one writer per counter, so no locked add
+	}
+	static Counts totals() {  // Sum over live threads and threads that have exited
+		std::lock_guard<std::mutex> guard(registryLock_);
+		Counts counts;
+		for (int c = 0; c < (int)OctreeCounter::Count; c++) {
+			counts.values_[c] = retired_[c];
+			for (ThreadCounters* thread : registry_) { counts.values_[c] += thread->values_[c].load(std::memory_order_relaxed); }
+		}
+		return counts;
+	}
+	static void reset() {  // Zero all counters, call while no tree operations are running
+		std::lock_guard<std::mutex> guard(registryLock_);
+		for (int c = 0; c < (int)OctreeCounter::Count; c++) {
+			retired_[c] = 0;
+			for (ThreadCounters* thread : registry_) { thread->values_[c].store(0, std::memory_order_relaxed); }
+		}
+	}
+	static const char* name(OctreeCounter c) {
+		static const char* names[] = { "nodes visited", "coordinate calls", "allocations", "object copies", "object moves",
+			"splits", "collapses", "migrated", "lost", "tree copies", "tree moves" };
+		return names[(int)c];
+	}
+	static void print(std::ostream& os = std::cout) {  // One line per non-zero counter
+		Counts counts = totals();
+		for (int c = 0; c < (int)OctreeCounter::Count; c++) {
+			if (counts.values_[c]) { os << name((OctreeCounter)c) << ": " << counts.values_[c] << std::endl; }
+		}
+	}
+
+private:
+	struct ThreadCounters {
+		std::atomic<uint64_t> values_[(int)OctreeCounter::Count];
+		ThreadCounters() {
+			for (std::atomic<uint64_t>& value : values_) { value.store(0, std::memory_order_relaxed); }
+			std::lock_guard<std::mutex> guard(registryLock_);
+			registry_.push_back(this);
+		}
+		~ThreadCounters() {  // fold into retired_ as the thread exits
+			std::lock_guard<std::mutex> guard(registryLock_);
+			for (int c = 0; c < (int)OctreeCounter::Count; c++) { retired_[c] += values_[c].load(std::memory_order_relaxed); }
+			registry_.erase(std::find(registry_.begin(), registry_.end(), this));
+		}
+	};
+	static ThreadCounters& local() {
+		thread_local ThreadCounters counters;
+		return counters;
+	}
+	static inline std::mutex registryLock_;
+	static inline std::vector<ThreadCounters*> registry_;
+	static inline uint64_t retired_[(int)OctreeCounter::Count] = {};
+};
 
 
 struct vec3 {  // 3 vector struct for octree coordinates
@@ -77,111 +218,409 @@ struct vec3 {  // 3 vector struct for octree coordinates
 	}
 };
 
-template <typename Tname> class Node {  // Node structure
+struct box3 {  // axis aligned box, for objects with spatial extent
+	vec3 min_, max_;
+
+	vec3 centre() const { return (min_ + max_) / 2; }  // exact for a point box
+
+	bool overlaps(const box3& B, int dims = 3) const {  // touching boxes overlap, dims 2 ignores z
+		return min_.x_ <= B.max_.x_ && B.min_.x_ <= max_.x_ && min_.y_ <= B.max_.y_ && B.min_.y_ <= max_.y_ &&
+			(dims == 2 || (min_.z_ <= B.max_.z_ && B.min_.z_ <= max_.z_));
+	}
+};
+
+struct plane3 {  // plane with unit or scaled normal, a point p is inside when normal_ . p + offset_ >= 0
+	vec3 normal_;
+	double offset_;
+
+	double distance(const vec3& V) const { return normal_.x_ * V.x_ + normal_.y_ * V.y_ + normal_.z_ * V.z_ + offset_; }  // signed, scaled by |normal_|
+};
+
+// Node layouts, choosing which optional fields a Node stores
+struct NoPayload {};
+
+template <int> struct NoNodeField {  // stands in for a field the layout drops, writes are discarded and reads give zero
+	template <typename T> NoNodeField& operator = (const T&) { return *this; }
+	template <typename T> NoNodeField& operator += (const T&) { return *this; }
+	operator double() const { return 0; }
+};
+
+enum class SplitRule { Midpoint, Median, SurfaceArea };  // where build() places the planes between child_ cells
+
+template <bool Parent = true, bool CentreOfData = true, bool ContentBounds = true, typename PayloadT = NoPayload, int Dims = 3, SplitRule Split = SplitRule::Midpoint>
+struct NodeLayout {  // dropped fields take no memory and aren't computed by build/update
+	static_assert(Dims == 2 || Dims == 3, "nodes split in 2 or 3 dimensions");
+	static constexpr bool parent = Parent;  // parent_, needed by updateTree(), updateNode(), addToTree(Obj) and moveTreeData()
+	static constexpr bool centreOfData = CentreOfData;  // x_, y_, z_, which read as 0 when dropped
+	static constexpr bool contentBounds = ContentBounds;  // contMin_, contMax_, set by refit()
+	typedef PayloadT Payload;  // payload_, for the caller's own per-node data
+	static constexpr int dims = Dims;  // 2 gives a quadtree, z is ignored and z_, zMax_, zMin_ are dropped
+	static constexpr SplitRule split = Split;  // rules other than Midpoint store split_ in each node
+};
+typedef NodeLayout<> FullNode;  // default, every field
+typedef NodeLayout<false, false, false> IndexNode;  // cell bounds, counts and children only, for pure spatial indexing
+typedef NodeLayout<true, true, true, NoPayload, 2> QuadNode;  // every field, in 2 dimensions
+typedef NodeLayout<false, false, false, NoPayload, 2> QuadIndexNode;
+typedef NodeLayout<true, true, true, NoPayload, 3, SplitRule::Median> MedianNode;  // every field, split at the per axis median
+typedef NodeLayout<true, true, true, NoPayload, 3, SplitRule::SurfaceArea> SurfaceAreaNode;  // every field, split at the cheapest plane by surface area
+
+template <typename Tname, typename Layout = FullNode> class Node {  // Node structure
 public:
 	Tname* Objs_;  // an array of objects
-	Node<Tname>* child_[8];  // pointers to child_ nodes
-	Node<Tname>* parent_;  // parent_ pointer
-	double x_, y_, z_;  // c.o.d. values
-	double xMax_, xMin_, yMax_, yMin_, zMax_, zMin_;
+	Node<Tname, Layout>** child_;  // pointers to the present child_ nodes, in octant order
+	[[no_unique_address]] std::conditional_t<Layout::parent, Node<Tname, Layout>*, NoNodeField<0>> parent_;  // parent_ pointer
+	[[no_unique_address]] std::conditional_t<Layout::centreOfData, double, NoNodeField<1>> x_;  // c.o.d. values
+	[[no_unique_address]] std::conditional_t<Layout::centreOfData, double, NoNodeField<2>> y_;
+	[[no_unique_address]] std::conditional_t<Layout::centreOfData && Layout::dims == 3, double, NoNodeField<3>> z_;
+	double xMax_, xMin_, yMax_, yMin_;
+	[[no_unique_address]] std::conditional_t<Layout::dims == 3, double, NoNodeField<6>> zMax_;
+	[[no_unique_address]] std::conditional_t<Layout::dims == 3, double, NoNodeField<7>> zMin_;
 	int num_;  // number of objects in node
 	bool leaf_;  // bool of whether node is a leaf
+	uint8_t mask_;  // occupancy mask, bit i is set when octant i has a child_ node
 	int depth_;  // depth of node in the tree
+	[[no_unique_address]] std::conditional_t<Layout::contentBounds, vec3, NoNodeField<4>> contMin_;  // bounds of the node's contents, set by refit()
+	[[no_unique_address]] std::conditional_t<Layout::contentBounds, vec3, NoNodeField<5>> contMax_;
+	[[no_unique_address]] std::conditional_t<Layout::split != SplitRule::Midpoint, vec3, NoNodeField<8>> split_;  // split point of the child_ cells, set by build()
+	[[no_unique_address]] typename Layout::Payload payload_;  // caller's per-node data, copied with the node
 
 	// Rule of 5, with variety for objects that can't be copied/moved
 	Node();
-	template <copyableOnly T = Tname> Node(Tname* Objects, Node<Tname>* child0, Node<Tname>* child1, Node<Tname>* child2, Node<Tname>* child3,
-		Node<Tname>* child4, Node<Tname>* child5, Node<Tname>* child6, Node<Tname>* child7, Node<Tname>* parent,
+	template <copyableOnly T = Tname> Node(Tname* Objects, Node<Tname, Layout>* child0, Node<Tname, Layout>* child1, Node<Tname, Layout>* child2, Node<Tname, Layout>* child3,
+		Node<Tname, Layout>* child4, Node<Tname, Layout>* child5, Node<Tname, Layout>* child6, Node<Tname, Layout>* child7, Node<Tname, Layout>* parent,
 		double x, double y, double z, double xMax, double xMin, double yMax, double yMin, double zMax, double zMin,
 		int num, int depth, bool leaf);
-	template <moveable T = Tname> Node(Tname* Objects, Node<Tname>* child0, Node<Tname>* child1, Node<Tname>* child2, Node<Tname>* child3,
-		Node<Tname>* child4, Node<Tname>* child5, Node<Tname>* child6, Node<Tname>* child7, Node<Tname>* parent,
+	template <moveable T = Tname> Node(Tname* Objects, Node<Tname, Layout>* child0, Node<Tname, Layout>* child1, Node<Tname, Layout>* child2, Node<Tname, Layout>* child3,
+		Node<Tname, Layout>* child4, Node<Tname, Layout>* child5, Node<Tname, Layout>* child6, Node<Tname, Layout>* child7, Node<Tname, Layout>* parent,
 		double x, double y, double z, double xMax, double xMin, double yMax, double yMin, double zMax, double zMin,
 		int num, int depth, bool leaf);
 	~Node();  // Destructor
-	template <copyable T = Tname> Node(const Node<Tname>& node);  // Copy constructor
-	template <moveableOnly T = Tname> Node(const Node<Tname>& node);  // Copy constructor
-	template <copyable T = Tname> Node& operator = (const Node<Tname>& node);  // Copy Assignment operator
-	template <moveableOnly T = Tname> Node& operator = (const Node<Tname>& node);  // Copy Assignment operator
-	template <moveable T = Tname> Node(Node<Tname>&& node);  // Move constructor
-	template <copyableOnly T = Tname> Node(Node<Tname>&& node);  // Move constructor
-	template <moveable T = Tname> Node& operator = (Node<Tname>&& node); // Move assignment operator
-	template <copyableOnly T = Tname> Node& operator = (Node<Tname>&& node); // Move assignment operator
+	template <copyable T = Tname> Node(const Node<Tname, Layout>& node);  // Copy constructor
+	template <moveableOnly T = Tname> Node(const Node<Tname, Layout>& node);  // Copy constructor
+	template <copyable T = Tname> Node& operator = (const Node<Tname, Layout>& node);  // Copy Assignment operator
+	template <moveableOnly T = Tname> Node& operator = (const Node<Tname, Layout>& node);  // Copy Assignment operator
+	template <moveable T = Tname> Node(Node<Tname, Layout>&& node);  // Move constructor
+	template <copyableOnly T = Tname> Node(Node<Tname, Layout>&& node);  // Move constructor
+	template <moveable T = Tname> Node& operator = (Node<Tname, Layout>&& node); // Move assignment operator
+	template <copyableOnly T = Tname> Node& operator = (Node<Tname, Layout>&& node); // Move assignment operator
 
 	// setter/getter functions
 	void setX(const double X) { x_ = X; }
 	void setY(const double Y) { y_ = Y; }
 	void setZ(const double Z) { z_ = Z; }
-	double getXLength() { return xMax_ - xMin_; }
-	double getYLength() { return yMax_ - yMin_; }
-	double getZLength() { return zMax_ - zMin_; }
+	double getXLength() const { return xMax_ - xMin_; }
+	double getYLength() const { return yMax_ - yMin_; }
+	double getZLength() const { return zMax_ - zMin_; }
+	bool hasChildren() const { return mask_ != 0; }
+	int numChildren() const { return std::popcount((unsigned)mask_); }
+	Node<Tname, Layout>* getChild(int i) const {  // child_ node in octant i, nullptr if absent
+		return ((mask_ >> i) & 1) ? child_[std::popcount((unsigned)mask_ & ((1u << i) - 1))] : nullptr;
+	}
+	int getChildOctant(const Node<Tname, Layout>* child) const;  // octant of a child_ node, -1 if not a child
+	void setChildren(Node<Tname, Layout>* const children[8]);  // Replace all children, nullptr for absent octants
+	void addChild(int i, Node<Tname, Layout>* child);  // Insert a child_ node in an absent octant
+	void removeChild(int i);  // Delete the child_ node in octant i
+	void clearChildren();  // Delete all child_ nodes
+	bool contains(const vec3& V) const {  // inclusive bounds test
+		return V.x_ >= xMin_ && V.x_ <= xMax_ && V.y_ >= yMin_ && V.y_ <= yMax_ && (Layout::dims < 3 || (V.z_ >= zMin_ && V.z_ <= zMax_));
+	}
+	vec3 getSplit() const {  // split point of the child_ cells, the stored one or the cell midpoint
+		if constexpr (Layout::split != SplitRule::Midpoint) { return split_; }
+		else { return vec3{ (xMax_ + xMin_) / 2, (yMax_ + yMin_) / 2, (zMax_ + zMin_) / 2 }; }
+	}
+	int getOctant(const vec3& V) const {  // child_ index of a position, matching build()
+		vec3 split = getSplit();
+		return (V.y_ > split.y_) + 2 * (V.x_ > split.x_) + ((Layout::dims == 3) ? 4 * (V.z_ > split.z_) : 0);
+	}
+};
+
+// On-disk octree format: header, node array, then objects in depth first leaf order
+struct OctreeFileHeader {
+	char magic_[8];  // "ELLIEOCT"
+	uint32_t version_;
+	uint32_t objSize_;  // sizeof(Tname) the file was written with
+	double xMax_, xMin_, yMax_, yMin_, zMax_, zMin_;  // root bounds
+	int32_t maxDepth_, maxLeaf_;
+	uint64_t numNodes_, numObjs_, rootIndx_;
+	uint64_t nodeOffset_, objOffset_;  // byte offsets of the node and object arrays
+};
+
+struct OctreeFileNode {
+	double x_, y_, z_;  // c.o.d. values
+	double xMax_, xMin_, yMax_, yMin_, zMax_, zMin_;
+	uint64_t firstObj_;  // index of the first object of this subtree, subtree objects are contiguous
+	int32_t num_;  // number of objects in node
+	int32_t depth_;  // depth of node in the tree
+	int32_t child_[8];  // child_ node indices, -1 if none
+	int32_t leaf_;  // whether node is a leaf
+	int32_t pad_;
+
+	bool hasChildren() const {  // children are sparse, so any octant may be the first present one
+		for (int i = 0; i < 8; i++) {
+			if (child_[i] >= 0) { return true; }
+		}
+		return false;
+	}
 };
 
-template <typename Tname>
+template <triviallyCopyable Tname> class OctreeStreamBuilder;
+template <triviallyCopyable Tname> class ShardedOctree;
+
+template <typename Tname, typename Instr = NoInstrumentation, typename Layout = FullNode>
 class Octree {  // bound Octree container class
 private:
-	Node<Tname>* root_;  // pointer to the root Node
+	template <triviallyCopyable T> friend class OctreeStreamBuilder;
+	Node<Tname, Layout>* root_;  // pointer to the root Node
 	int maxDepth_, maxLeaf_;  // maximum tree depth and leaf amount
 
+	struct MovedObj {  // object in transit during a parallel update
+		Tname obj;
+		vec3 coords;
+	};
+	Node<Tname, Layout>* descendToLeaf(Node<Tname, Layout>* node, const vec3& V) const;  // Deepest node below node holding V, stops at an absent child_
+	bool owns(const Node<Tname, Layout>* node, const vec3& V) const {  // whether build() would route V into node's cell, i.e. contains() with faces shared by a sibling going to the lower cell
+		auto axis = [](double v, double lo, double hi, double rootLo) { return v <= hi && (v > lo || (v == lo && lo == rootLo)); };
+		return axis(V.x_, node->xMin_, node->xMax_, root_->xMin_) && axis(V.y_, node->yMin_, node->yMax_, root_->yMin_) &&
+			(Layout::dims < 3 || axis(V.z_, node->zMin_, node->zMax_, root_->zMin_));
+	}
+	Node<Tname, Layout>* makeChild(Node<Tname, Layout>* node, int octant);  // Empty leaf in an absent octant of node
+	Node<Tname, Layout>* makeLeaf(Node<Tname, Layout>* node, const vec3& V);  // Leaf below node holding V, creating it in an empty region
+	void insertMovedObjs(Node<Tname, Layout>* node, std::vector<MovedObj>& inbox);  // Append objects to leaves below node
+	void refreshNode(Node<Tname, Layout>* node);  // Bottom-up split/collapse/c.o.d. pass
+	void refreshAncestors(Node<Tname, Layout>* node, int frontierDepth);  // Bottom-up pass over nodes above the frontier
+	int getFrontier(int numThreads, std::vector<Node<Tname, Layout>*>& tasks) const;  // Disjoint subtrees for workers, returns frontier depth
+	void combineChildren(Node<Tname, Layout>* node);  // Recompute an internal node from finished children
+	static vec3 chooseSplit(Node<Tname, Layout>* node, const vec3* V);  // Split point for node's objects by Layout::split, stored in the node
+
+public:
+	struct OctreeStats {  // memory footprint and shape of the tree, see stats()
+		int numNodes_ = 0, numInternal_ = 0, numLeaves_ = 0, numEmpty_ = 0;
+		int numObjs_ = 0;  // objects held in leaves
+		std::vector<int> nodesByDepth_;  // node count per depth, index 0 is the root
+		std::vector<int> leafOccupancy_;  // leaf count per object count, the last bin holds leaves over maxLeaf (at maxDepth)
+		size_t nodeBytes_ = 0;  // nodes and their child_ arrays
+		size_t objBytes_ = 0;  // leaf object arrays
+		size_t slackBytes_ = 0;  // stale internal node arrays and unused stage() capacity
+		int maxDepth_ = 0;  // depth_ of the deepest node, numbered as maxDepth
+		double meanLeafDepth_ = 0, meanObjDepth_ = 0;  // mean depth per leaf and per object
+	};
+
+	struct RefitQuality {  // how far a refit tree has drifted from its topology
+		int misplaced_;  // objects lying outside their leaf's cell
+		double misplacedFraction_;  // misplaced_ / number of objects
+		double maxOverhang_;  // largest distance contents extend past a leaf cell, in units of the cell length
+	};
+
+	struct CutNode {  // one node of a level of detail cut, standing in for all the objects below it
+		vec3 position_;  // the node's c.o.d.
+		int weight_;  // the node's num_
+		const Node<Tname, Layout>* node_;
+	};
+
+	enum class SyncAction { Refit, Update, Rebuild };  // ways synchronize() can bring the tree up to date
+
+	struct SyncModel {  // calibrated cost model used by synchronize()
+		double refitCost_ = 2e-8;  // seconds per object for a refit
+		double updateMoveCost_ = 2e-7;  // seconds per displaced object in an update, on top of a refit-like scan
+		double rebuildCost_ = 3e-7;  // seconds per object for a full rebuild
+		double refitTolerance_ = 0.001;  // largest displaced fraction a refit may absorb
+		double smoothing_ = 0.25;  // weight of the newest timing in the running calibration
+	};
+
+	struct SyncReport {  // decision and timings of the last synchronize()
+		SyncAction action_ = SyncAction::Rebuild;
+		double displacedFraction_ = 0;  // estimated fraction of objects outside their leaf
+		double refitEstimate_ = 0, updateEstimate_ = 0, rebuildEstimate_ = 0;  // predicted seconds
+		double estimateTime_ = 0, actionTime_ = 0;  // measured seconds
+	};
+
+private:
+	SyncModel syncModel_;
+	SyncReport lastSync_;
+	std::vector<Tname> staged_;  // objects waiting for flush()
+	static constexpr int numInsertBuckets = 64;
+	struct InsertBucket {  // lock-guarded objects waiting for consolidate()
+		std::mutex lock_;
+		std::vector<MovedObj> objs_;
+	};
+	std::atomic<InsertBucket*> insertBuckets_{ nullptr };  // numInsertBuckets buckets, allocated by the first concurrentInsert()
+	InsertBucket* getInsertBuckets() {  // Allocate the buckets once, the thread losing the race frees its own
+		InsertBucket* buckets = insertBuckets_.load(std::memory_order_acquire);
+		if (buckets) { return buckets; }
+		InsertBucket* fresh = new InsertBucket[numInsertBuckets];
+		if (insertBuckets_.compare_exchange_strong(buckets, fresh, std::memory_order_acq_rel)) { return fresh; }
+		delete[] fresh;
+		return buckets;
+	}
+	std::vector<std::pair<uint64_t, Node<Tname, Layout>*>> nodeTable_;  // nodes by getCellKey(), open addressed, key 0 marks a free slot
+	int tableShift_ = 0;  // 64 - log2 of the table size, for the multiplicative hash
+	int tableHint_ = 0;  // level below the root holding the most objects' leaves, probed first by lookupLeaf()
+	Node<Tname, Layout>* findCell(uint64_t key) const {  // Probe the node table, nullptr if the cell has no node
+		if (nodeTable_.empty()) { return nullptr; }
+		size_t mask = nodeTable_.size() - 1;
+		for (size_t i = (size_t)((key * 0x9E3779B97F4A7C15ull) >> tableShift_); ; i = (i + 1) & mask) {
+			if (nodeTable_[i].first == key) { return nodeTable_[i].second; }
+			if (nodeTable_[i].first == 0) { return nullptr; }
+		}
+	}
+	void mergeObjs(std::vector<MovedObj>& objs);  // Merge objects into their leaves in Morton order
+	void mergeNode(Node<Tname, Layout>* node, Node<Tname, Layout>* other);  // Merge a node of another tree covering the same cell, freeing it
+	bool growRoot(const vec3& lo, const vec3& hi);  // Double the root cell towards a box until it holds it, false if an axis can't grow
+	void drainNode(Node<Tname, Layout>* node, Tname* ObjArr, int& counter);  // Move/copy leaf objects below node into ObjArr
+	void copyNodeData(const Node<Tname, Layout>* node, Tname* ObjArr, int& counter) const;  // Copy leaf objects below node into ObjArr
+	typedef std::vector<std::pair<const Node<Tname, Layout>*, Node<Tname, Layout>*>> CloneTasks;  // source nodes and their unfinished copies
+	Node<Tname, Layout>* cloneNode(const Node<Tname, Layout>* node, Node<Tname, Layout>* parent, int frontierDepth = -2, CloneTasks* deferred = nullptr) const;  // Copy of a subtree
+	void cloneContents(const Node<Tname, Layout>* node, Node<Tname, Layout>* copy, int frontierDepth = -2, CloneTasks* deferred = nullptr) const;  // Copy children or objects
+	void takeNodes(Octree<Tname, Instr, Layout>& O);  // Take over O's nodes, leaving O empty within the same bounds
+	int flattenNode(const Node<Tname, Layout>* node, std::vector<OctreeFileNode>& nodes, uint64_t& objCounter) const;  // Depth first node array
+	bool writeNodeData(const Node<Tname, Layout>* node, FILE* file) const;  // Write leaf objects in depth first order
+	void refitNode(Node<Tname, Layout>* node, RefitQuality& quality);  // Bottom-up refit of a subtree
+	void combineRefit(Node<Tname, Layout>* node);  // Refit an internal node from its children
+	void refitAncestors(Node<Tname, Layout>* node, int frontierDepth);  // Refit nodes above the frontier
+	void statsNode(const Node<Tname, Layout>* node, OctreeStats& stats) const;  // Accumulate stats() over a subtree
+	typedef std::vector<std::pair<Node<Tname, Layout>*, Node<Tname, Layout>*>> CollideTasks;  // node pairs left for collidePairs() workers
+	struct LeafBoxes {  // boxes of every leaf's objects, computed once per collidePairs()
+		std::unordered_map<const Node<Tname, Layout>*, int> offset_;  // index of a leaf's first box
+		std::vector<box3> boxes_;
+	};
+	void collideNodes(Node<Tname, Layout>* a, Node<Tname, Layout>* b, const LeafBoxes& boxes, std::vector<std::pair<Tname*, Tname*>>& pairs, int frontierDepth = -2, CollideTasks* deferred = nullptr) const;  // Overlapping pairs between two subtrees, or within one
+	struct RayPacket {  // 8 rays, one per lane, laid out so the slab tests vectorise
+		double ox_[8], oy_[8], oz_[8];  // origins
+		double ix_[8], iy_[8], iz_[8];  // inverse directions
+		double tmax_[8];
+		uint8_t stopped_;  // lanes whose visit returned true
+		int signs_;  // child index bits of the negative directions shared by the traversed lanes
+	};
+	static vec3 rayInverse(const vec3& dir);  // 1 / dir, with zero components nudged so slab tests stay finite
+	static bool raySlab(const Node<Tname, Layout>* node, const vec3& origin, const vec3& inv, double tmax, double& tEnter, double& tExit);  // Ray/cell interval within [0, tmax]
+	static uint8_t packetSlab(const Node<Tname, Layout>* node, const RayPacket& P, uint8_t active, double* tEnter, double* tExit);  // raySlab for 8 lanes, returns the active lanes that hit
+	template<typename F> Node<Tname, Layout>* raycastNode(Node<Tname, Layout>* node, const vec3& origin, const vec3& inv, double tEnter, double tExit, double tmax, F& visit) const;  // Front to back below node
+	template<typename F> void packetNode(Node<Tname, Layout>* node, RayPacket& P, uint8_t active, const double* tEnter, const double* tExit, F& visit) const;  // Packet traversal below node
+	typedef std::vector<std::pair<const Node<Tname, Layout>*, size_t>> CutTasks;  // subtrees left for extractCut() workers, and where their cut goes
+	template<typename F> void cutNode(const Node<Tname, Layout>* node, F& stop, std::vector<CutNode>& cut, int frontierDepth = -2, CutTasks* deferred = nullptr) const;  // Cut through a subtree
+	static void transfer(Tname& dest, Tname& src) {  // transferObj, counted as a move or a copy
+		Instr::count(moveable<Tname> ? OctreeCounter::ObjMoves : OctreeCounter::ObjCopies);
+		transferObj(dest, src);
+	}
+	static void countTransfers(uint64_t n) { Instr::count(moveable<Tname> ? OctreeCounter::ObjMoves : OctreeCounter::ObjCopies, n); }  // for the legacy loops assigning directly
+
 public:
 	typedef vec3(*objToCoord)(Tname& Obj);  // Function pointer
+	typedef vec3(*objToCoordCtx)(Tname& Obj, const void* context);  // Function pointer with context, used by IndexOctree
 	objToCoord func;  // Function to convert an object to a coordinate
+	objToCoordCtx funcCtx = nullptr;  // used instead of func when set
+	const void* funcContext = nullptr;  // passed to funcCtx
+	typedef box3(*objToBox)(Tname& Obj);  // Function pointer to an object's bounding box
+	objToBox boxFunc = nullptr;  // used when neither func nor funcCtx is set, objects are placed by their box centre
+	vec3 getCoords(Tname& Obj) const {  // Coordinates of an object
+		Instr::count(OctreeCounter::CoordCalls);
+		return funcCtx ? funcCtx(Obj, funcContext) : (func ? func(Obj) : boxFunc(Obj).centre());
+	}
+	box3 getBox(Tname& Obj) const {  // Bounding box of an object, a point box without boxFunc
+		if (!boxFunc) {
+			vec3 V = getCoords(Obj);
+			return box3{ V, V };
+		}
+		Instr::count(OctreeCounter::CoordCalls);
+		return boxFunc(Obj);
+	}
 
 	// Rule of 5, with variety for objects that can't be copied/moved
 	Octree();
 	Octree(Tname* Objects, objToCoord funcToPlace, int objArrSize, int maxDepth, int maxLeafSize, double xMin = 0, double xMax = 0, double yMin = 0, double yMax = 0, double zMin = 0, double zMax = 0);  // Constructor
+	Octree(Tname* Objects, objToCoordCtx funcToPlace, const void* context, int objArrSize, int maxDepth, int maxLeafSize, double xMin = 0, double xMax = 0, double yMin = 0, double yMax = 0, double zMin = 0, double zMax = 0);  // Constructor with a coordinate context
+	Octree(Tname* Objects, objToBox boxToPlace, int objArrSize, int maxDepth, int maxLeafSize, double xMin = 0, double xMax = 0, double yMin = 0, double yMax = 0, double zMin = 0, double zMax = 0);  // Constructor for objects with extent
 	~Octree();  // Destructor
-	template <copyable T = Tname> Octree(const Octree<Tname>& O);  // Copy constructor
-	template <moveableOnly T = Tname> Octree(const Octree<Tname>& O);  // Copy constructor
-	template <copyable T = Tname> Octree& operator = (const Octree<Tname>& O);  // Copy Assignment operator
-	template <moveableOnly T = Tname> Octree& operator = (const Octree<Tname>& O);  // Copy Assignment operator
-	Octree(Octree<Tname>&& O);  // Move constructor
-	Octree& operator = (Octree<Tname>&& O); // Move assignment operator
+	Octree(const Octree<Tname, Instr, Layout>& O) requires copyable<Tname>;  // Copy constructor (constrained rather than templated, so it is a real copy constructor)
+	Octree(const Octree<Tname, Instr, Layout>& O) requires moveableOnly<Tname>;  // Copy constructor
+	Octree& operator = (const Octree<Tname, Instr, Layout>& O) requires copyable<Tname>;  // Copy Assignment operator
+	Octree& operator = (const Octree<Tname, Instr, Layout>& O) requires moveableOnly<Tname>;  // Copy Assignment operator
+	Octree(Octree<Tname, Instr, Layout>&& O);  // Move constructor
+	Octree& operator = (Octree<Tname, Instr, Layout>&& O); // Move assignment operator
 
 	// setter/getter functions
 	void setFunc(objToCoord funcToPlace) { func = funcToPlace; }  // Sets the function to convert an object to a set of coords
-	Node<Tname>* getRoot() const { return root_; };
-	Node<Tname>* getNode(const int depth, const double X, const double Y, const double Z) const;  // Return Node at depth/position
-	Tname* getNodeData(Node<Tname>* node) { return node->Objs_; }  // Return Node data
+	void setBoxFunc(objToBox boxToPlace) { func = nullptr; funcCtx = nullptr; boxFunc = boxToPlace; }  // Sets the function giving an object's bounding box, placing objects by its centre
+	Node<Tname, Layout>* getRoot() const { return root_; };
+	Node<Tname, Layout>* getNode(const int depth, const double X, const double Y, const double Z) const;  // Return Node at depth/position
+	Tname* getNodeData(Node<Tname, Layout>* node) { return node->Objs_; }  // Return Node data
 	double getMaxDepth() { return maxDepth_; }
 	double getMaxLeaf() { return maxLeaf_; }
-	int getDataSize(Node<Tname>* node, bool homeNode = true);  // Get data length at Node
+	int getDataSize(Node<Tname, Layout>* node, bool homeNode = true) const;  // Get data length at Node (homeNode is unused, kept for compatibility)
+	OctreeStats stats() const;  // Node counts, leaf occupancy, memory use and depths in one walk
 
 	// Member functions
-	Node<Tname>* findLeafNode(const double X, const double Y, const double Z) const;  // Returns a Leaf Node at position (x, y, z)
-	template<copyableOnly T = Tname> void build(Node<Tname>* node, int depth = -1);  // Build tree
-	template<moveable T = Tname> void build(Node<Tname>* node, int depth = -1);  // Build tree
-	template<copyableOnly T = Tname> Tname* updateTree(Node<Tname>* node, Tname* lostObjs = nullptr, int oldRootSize = 0);
-	template<moveable T = Tname> Tname* updateTree(Node<Tname>* node, Tname* lostObjs = nullptr, int oldRootSize = 0);
-	template<copyableOnly T = Tname> void updateNode(Node<Tname>* node);
-	template<moveable T = Tname> void updateNode(Node<Tname>* node);
-	template<copyable T = Tname> Tname* copyTreeData(Node<Tname>* node, Tname* ObjArr = nullptr, bool homeNode = true) const;  // Return all data
-	template<moveable T = Tname> Tname* moveTreeData(Node<Tname>* node, Tname* ObjArr = nullptr, bool homeNode = true);  // Return all data
+	Node<Tname, Layout>* findLeafNode(const double X, const double Y, const double Z) const;  // Returns a Leaf Node at position (x, y, z), nullptr if out of bounds or in an empty region
+	template<copyableOnly T = Tname> void build(Node<Tname, Layout>* node, int depth = -1);  // Build tree
+	template<moveable T = Tname> void build(Node<Tname, Layout>* node, int depth = -1);  // Build tree
+	template<copyableOnly T = Tname> Tname* updateTree(Node<Tname, Layout>* node, Tname* lostObjs = nullptr, int oldRootSize = 0);
+	template<moveable T = Tname> Tname* updateTree(Node<Tname, Layout>* node, Tname* lostObjs = nullptr, int oldRootSize = 0);
+	template<copyableOnly T = Tname> void updateNode(Node<Tname, Layout>* node);
+	template<moveable T = Tname> void updateNode(Node<Tname, Layout>* node);
+	Tname* parallelUpdateTree(int numThreads = 0);  // Two-phase update over disjoint subtrees, returns lost objects
+	RefitQuality refit(int numThreads = 0);  // Recompute c.o.d. and content bounds keeping topology and leaf membership
+	double estimateDisplaced(int sampleSize = 1024) const;  // Sampled fraction of objects outside their leaf
+	Tname* rebuildTree();  // Rebuild within the current root bounds, returns objects outside them
+	void rebuildWith(Tname* ObjArr, int size);  // Rebuild with extra objects, growing the root bounds if needed
+	Tname* synchronize(double displacedFraction = -1, int numThreads = 0, int sampleSize = 1024);  // Refit, update or rebuild, whichever is predicted cheapest
+	SyncModel& getSyncModel() { return syncModel_; }
+	const SyncReport& getLastSync() const { return lastSync_; }
+	uint64_t getMortonKey(const vec3& V) const;  // 63 bit key ordering positions as a depth first walk of the tree would
+	void stage(Tname Obj);  // Buffer an object for the next flush()
+	void flush();  // Add all staged objects, one allocation and at most one split per leaf
+	int getStagedSize() const { return (int)staged_.size(); }
+	void concurrentInsert(Tname Obj);  // Thread-safe insert into a leaf's bucket, visible after consolidate()
+	void consolidate();  // Merge concurrently inserted objects, splitting leaves and updating nodes once
+	void cloneFrom(const Octree<Tname, Instr, Layout>& O, int numThreads = 0);  // Replace this tree with a structural copy of O, subtrees copied in parallel
+	void merge(Octree<Tname, Instr, Layout>&& O);  // Take over O's objects node by node, leaving O empty within its bounds
+	std::vector<std::pair<Tname*, Tname*>> collidePairs(int numThreads = 0);  // Refit, then every pair of objects whose boxes overlap, pointing into the leaves
+	template<typename F> Node<Tname, Layout>* raycast(const vec3& origin, const vec3& dir, double tmax, F&& visit) const;  // Non-empty leaves the ray crosses front to back, visit(leaf, tEnter, tExit) returns true to stop there
+	Node<Tname, Layout>* raycast(const vec3& origin, const vec3& dir, double tmax = std::numeric_limits<double>::infinity()) const {  // First non-empty leaf the ray crosses
+		return raycast(origin, dir, tmax, [](Node<Tname, Layout>*, double, double) { return true; });
+	}
+	template<typename F> uint8_t raycast8(const vec3 origins[8], const vec3 dirs[8], double tmax[8], F&& visit) const;  // 8 ray packet, visit(lane, leaf, tEnter, tExit), returns the lanes that stopped
+	bool buildNodeTable();  // Hash every node by its cell key, false if the keys don't fit in 64 bits
+	void clearNodeTable() { nodeTable_.clear(); tableShift_ = 0; tableHint_ = 0; }  // Drop the node table, structural changes do so lookups miss rather than reach freed nodes
+	uint64_t getCellKey(const vec3& V, int depth) const;  // Key of the depth cell holding V, its octant path below a leading 1 bit
+	Node<Tname, Layout>* lookupNode(int depth, const vec3& V) const;  // Node at depth holding V with one probe, nullptr if absent
+	Node<Tname, Layout>* lookupLeaf(const vec3& V) const;  // findLeafNode() by binary search over depth in the node table
+	Node<Tname, Layout>* lookupParent(const Node<Tname, Layout>* node) const;  // Parent through the node table, for layouts without parent_
+	Node<Tname, Layout>* lookupNeighbour(const Node<Tname, Layout>* node, int dx, int dy, int dz = 0) const;  // Same depth node offset by whole cells, nullptr if absent
+	template<typename F> std::vector<CutNode> extractCut(F&& stop, int numThreads = 0) const;  // Non-empty leaves and nodes where stop(node) holds, in depth first order
+	template<typename F> bool cullFrustum(const plane3* planes, int numPlanes, F&& visit) const;  // Convex polytope query, visit(node, inside) for nodes inside all planes and leaves crossing some, false over 32 planes
+	template<typename F> bool cullFrustum(const plane3 planes[6], F&& visit) const { return cullFrustum(planes, 6, visit); }  // View frustum query
+	std::vector<uint32_t> getTreeOrder(Tname* ObjArr, int size, int numThreads = 0) const;  // Old index of each position when ObjArr is sorted into depth first leaf order
+	template<typename... Ts> void reorder(Tname* ObjArr, int size, Ts*... arrays) const;  // Permute ObjArr and companion arrays into depth first leaf order
+	template<triviallyCopyable T = Tname> bool writeFile(const char* path) const;  // Write the flat on-disk format, see OctreeView, octrees only
+	template<copyable T = Tname> Tname* copyTreeData(Node<Tname, Layout>* node, Tname* ObjArr = nullptr, bool homeNode = true) const;  // Return all data, safe for concurrent readers
+	template<moveable T = Tname> Tname* moveTreeData(Node<Tname, Layout>* node, Tname* ObjArr = nullptr, bool homeNode = true);  // Return all data
 	template<copyableOnly T = Tname> void addToTree(Tname Obj);  // Add an object
 	template<moveable T = Tname> void addToTree(Tname Obj);  // Add an object
 	template<copyableOnly T = Tname> void addToTree(Tname* ObjArr, int size);  // Add arrays of objects
 	template<moveable T = Tname> void addToTree(Tname* ObjArr, int size);  // Add arrays of objects
 };
 
+template <typename Tname, typename Instr = NoInstrumentation> using Quadtree = Octree<Tname, Instr, QuadNode>;  // 2D tree, the z coordinate is ignored
+
 
 // Node constructors/destructor
-template <typename Tname> Node<Tname>::Node() {
+template <typename Tname, typename Layout> Node<Tname, Layout>::Node() {
 	Objs_ = nullptr;
-	for (int i = 0; i < 8; i++) {
-		child_[i] = nullptr;
-	}
+	child_ = nullptr; mask_ = 0;
 	parent_ = nullptr;
 	x_ = y_ = z_ = 0;
 	num_ = 0;
 	xMax_ = xMin_ = yMax_ = yMin_ = zMax_ = zMin_ = 0;
 	depth_ = 0; leaf_ = false;
+	contMin_ = contMax_ = vec3{ 0, 0, 0 };
+	split_ = vec3{ 0, 0, 0 };
 }
 
-template <typename Tname>
+template <typename Tname, typename Layout>
 template<copyableOnly>
-Node<Tname>::Node(Tname* ObjArr, Node<Tname>* child0, Node<Tname>* child1, Node<Tname>* child2,
-	Node<Tname>* child3, Node<Tname>* child4, Node<Tname>* child5,
-	Node<Tname>* child6, Node<Tname>* child7, Node<Tname>* parent, double x,
+Node<Tname, Layout>::Node(Tname* ObjArr, Node<Tname, Layout>* child0, Node<Tname, Layout>* child1, Node<Tname, Layout>* child2,
+	Node<Tname, Layout>* child3, Node<Tname, Layout>* child4, Node<Tname, Layout>* child5,
+	Node<Tname, Layout>* child6, Node<Tname, Layout>* child7, Node<Tname, Layout>* parent, double x,
 	double y, double z, double xMax, double xMin, double yMax, double yMin,
 	double zMax, double zMin, int num, int depth, bool leaf) {
 	if (num > 0) {
@@ -193,20 +632,23 @@ Node<Tname>::Node(Tname* ObjArr, Node<Tname>* child0, Node<Tname>* child1, Node<
 	else {
 		Objs_ = nullptr;
 	}
-	child_[0] = child0; child_[1] = child1; child_[2] = child2; child_[3] = child3;
-	child_[4] = child4; child_[5] = child5; child_[6] = child6; child_[7] = child7;
+	Node<Tname, Layout>* children[8] = { child0, child1, child2, child3, child4, child5, child6, child7 };
+	child_ = nullptr; mask_ = 0;
+	setChildren(children);
 	parent_ = parent;
 	x_ = x; y_ = y; z_ = z;
 	xMax_ = xMax; xMin_ = xMin; yMax_ = yMax; yMin_ = yMin; zMax_ = zMax; zMin_ = zMin;
 	num_ = num;
 	depth_ = depth; leaf_ = leaf;
+	contMin_ = contMax_ = vec3{ 0, 0, 0 };
+	split_ = vec3{ 0, 0, 0 };
 }
 
-template <typename Tname>
+template <typename Tname, typename Layout>
 template<moveable>
-Node<Tname>::Node(Tname* ObjArr, Node<Tname>* child0, Node<Tname>* child1, Node<Tname>* child2,
-	Node<Tname>* child3, Node<Tname>* child4, Node<Tname>* child5,
-	Node<Tname>* child6, Node<Tname>* child7, Node<Tname>* parent, double x,
+Node<Tname, Layout>::Node(Tname* ObjArr, Node<Tname, Layout>* child0, Node<Tname, Layout>* child1, Node<Tname, Layout>* child2,
+	Node<Tname, Layout>* child3, Node<Tname, Layout>* child4, Node<Tname, Layout>* child5,
+	Node<Tname, Layout>* child6, Node<Tname, Layout>* child7, Node<Tname, Layout>* parent, double x,
 	double y, double z, double xMax, double xMin, double yMax, double yMin,
 	double zMax, double zMin, int num, int depth, bool leaf) {
 	if (num > 0) {
@@ -218,33 +660,87 @@ Node<Tname>::Node(Tname* ObjArr, Node<Tname>* child0, Node<Tname>* child1, Node<
 	else {
 		Objs_ = nullptr;
 	}
-	child_[0] = child0; child_[1] = child1; child_[2] = child2; child_[3] = child3;
-	child_[4] = child4; child_[5] = child5; child_[6] = child6; child_[7] = child7;
+	Node<Tname, Layout>* children[8] = { child0, child1, child2, child3, child4, child5, child6, child7 };
+	child_ = nullptr; mask_ = 0;
+	setChildren(children);
 	parent_ = parent;
 	x_ = x; y_ = y; z_ = z;
 	xMax_ = xMax; xMin_ = xMin; yMax_ = yMax; yMin_ = yMin; zMax_ = zMax; zMin_ = zMin;
 	num_ = num;
 	depth_ = depth; leaf_ = leaf;
+	contMin_ = contMax_ = vec3{ 0, 0, 0 };
+	split_ = vec3{ 0, 0, 0 };
 }
 
-template <typename Tname> Node<Tname>::~Node() {
+template <typename Tname, typename Layout> Node<Tname, Layout>::~Node() {
 	if (Objs_) {  // If there is an array of objects
 		delete[] Objs_;
 	}
+	clearChildren();  // delete children
+}
+
+// Node child functions
+template <typename Tname, typename Layout> int Node<Tname, Layout>::getChildOctant(const Node<Tname, Layout>* child) const {
+	for (int i = 0; i < 8; i++) {
+		if (child != nullptr && getChild(i) == child) { return i; }
+	}
+	return -1;
+}
+
+template <typename Tname, typename Layout> void Node<Tname, Layout>::setChildren(Node<Tname, Layout>* const children[8]) {
+	if (child_) { delete[] child_; }
+	mask_ = 0;
+	for (int i = 0; i < 8; i++) {
+		if (children[i]) { mask_ |= (uint8_t)(1u << i); }
+	}
+	child_ = mask_ ? new Node<Tname, Layout>*[numChildren()] : nullptr;
+	int k = 0;
 	for (int i = 0; i < 8; i++) {
-		if (child_[i] != nullptr) { delete child_[i]; }  // iterate over children
+		if (children[i]) { child_[k++] = children[i]; }
+	}
+}
+
+template <typename Tname, typename Layout> void Node<Tname, Layout>::addChild(int i, Node<Tname, Layout>* child) {
+	int n = numChildren();
+	int pos = std::popcount((unsigned)mask_ & ((1u << i) - 1));  // compact index of octant i
+	Node<Tname, Layout>** children = new Node<Tname, Layout>*[n + 1];
+	for (int k = 0; k < pos; k++) { children[k] = child_[k]; }
+	children[pos] = child;
+	for (int k = pos; k < n; k++) { children[k + 1] = child_[k]; }
+	if (child_) { delete[] child_; }
+	child_ = children;
+	mask_ |= (uint8_t)(1u << i);
+}
+
+template <typename Tname, typename Layout> void Node<Tname, Layout>::removeChild(int i) {
+	if (!((mask_ >> i) & 1)) { return; }
+	int n = numChildren();
+	int pos = std::popcount((unsigned)mask_ & ((1u << i) - 1));
+	delete child_[pos];
+	for (int k = pos; k < n - 1; k++) { child_[k] = child_[k + 1]; }  // keep the array, it is only ever shrunk
+	mask_ &= (uint8_t)~(1u << i);
+	if (mask_ == 0) { delete[] child_; child_ = nullptr; }
+}
+
+template <typename Tname, typename Layout> void Node<Tname, Layout>::clearChildren() {
+	for (int i = 0; i < numChildren(); i++) {
+		delete child_[i];  // iterate over children
 	}
+	if (child_) { delete[] child_; }
+	child_ = nullptr; mask_ = 0;
 }
 
 // Node copy constructors
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <copyable>
-Node<Tname>::Node(const Node<Tname>& node) {  // Node copy constructor
+Node<Tname, Layout>::Node(const Node<Tname, Layout>& node) {  // Node copy constructor
 	Objs_ = new Tname[node.num_];  // Copy objects
 	for (int i = 0; i < node.num_; i++) {
 		Objs_[i] = node.Objs_[i];
 	}
-	for (int i = 0; i < 8; i++) {
+	mask_ = node.mask_;
+	child_ = mask_ ? new Node<Tname, Layout>*[numChildren()] : nullptr;
+	for (int i = 0; i < numChildren(); i++) {
 		child_[i] = node.child_[i];
 	}
 	parent_ = node.parent_;
@@ -252,19 +748,23 @@ Node<Tname>::Node(const Node<Tname>& node) {  // Node copy constructor
 	xMax_ = node.xMax_; xMin_ = node.xMin_; yMax_ = node.yMax_; yMin_ = node.yMin_; zMax_ = node.zMax_; zMin_ = node.zMin_;
 	num_ = node.num_;
 	depth_ = node.depth_;
+	contMin_ = node.contMin_; contMax_ = node.contMax_;
 	leaf_ = node.leaf_;
+	split_ = node.split_;
+	payload_ = node.payload_;
 }
 
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <moveableOnly>
-Node<Tname>::Node(const Node<Tname>& node) {  // Node copy constructor
-	std::cout << "Copying Node, moving Objects." << std::endl;
+Node<Tname, Layout>::Node(const Node<Tname, Layout>& node) {  // Node copy constructor, objects can't be copied so they are moved
 	Objs_ = new Tname[node.num_];  // Move objects
 	for (int i = 0; i < node.num_; i++) {
 		Objs_[i] = std::move(node.Objs_[i]);
 	}
 	delete[] node.Objs_;
-	for (int i = 0; i < 8; i++) {
+	mask_ = node.mask_;
+	child_ = mask_ ? new Node<Tname, Layout>*[numChildren()] : nullptr;
+	for (int i = 0; i < numChildren(); i++) {
 		child_[i] = node.child_[i];
 	}
 	parent_ = node.parent_;
@@ -272,13 +772,16 @@ Node<Tname>::Node(const Node<Tname>& node) {  // Node copy constructor
 	xMax_ = node.xMax_; xMin_ = node.xMin_; yMax_ = node.yMax_; yMin_ = node.yMin_; zMax_ = node.zMax_; zMin_ = node.zMin_;
 	num_ = node.num_;
 	depth_ = node.depth_;
+	contMin_ = node.contMin_; contMax_ = node.contMax_;
 	leaf_ = node.leaf_;
+	split_ = node.split_;
+	payload_ = node.payload_;
 }
 
 // Node copy assign operators
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <copyable>
-Node<Tname>& Node<Tname>::operator = (const Node<Tname>& node) {  // Octree copy assignment operator
+Node<Tname, Layout>& Node<Tname, Layout>::operator = (const Node<Tname, Layout>& node) {  // Octree copy assignment operator
 	if (&node == this) return *this;  // no self assignment
 	delete[] Objs_;  // delete the object pointer array
 	Objs_ = new Tname[node.num_];
@@ -286,8 +789,9 @@ Node<Tname>& Node<Tname>::operator = (const Node<Tname>& node) {  // Octree copy
 		Objs_[i] = node.Objs_[i];
 	}
 	delete[] child_;
-	child_ = new Node[8];
-	for (int i = 0; i < 8; i++) {
+	mask_ = node.mask_;
+	child_ = mask_ ? new Node<Tname, Layout>*[numChildren()] : nullptr;
+	for (int i = 0; i < numChildren(); i++) {
 		child_[i] = node.child_[i];
 	}
 	delete[] parent_;
@@ -296,14 +800,16 @@ Node<Tname>& Node<Tname>::operator = (const Node<Tname>& node) {  // Octree copy
 	xMax_ = node.xMax_; xMin_ = node.xMin_; yMax_ = node.yMax_; yMin_ = node.yMin_; zMax_ = node.zMax_; zMin_ = node.zMin_;
 	num_ = node.num_;
 	depth_ = node.depth_;
+	contMin_ = node.contMin_; contMax_ = node.contMax_;
 	leaf_ = node.leaf_;
+	split_ = node.split_;
+	payload_ = node.payload_;
 	return *this;
 }
 
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <moveableOnly>
-Node<Tname>& Node<Tname>::operator = (const Node<Tname>& node) {  // Node copy assignment operator
-	std::cout << "Copying Node, moving Objects." << std::endl;
+Node<Tname, Layout>& Node<Tname, Layout>::operator = (const Node<Tname, Layout>& node) {  // Node copy assignment operator, objects can't be copied so they are moved
 	if (&node == this) return *this;  // no self assignment
 	delete[] Objs_;  // delete the object pointer array
 	Objs_ = new Tname[node.num_];
@@ -312,8 +818,9 @@ Node<Tname>& Node<Tname>::operator = (const Node<Tname>& node) {  // Node copy a
 	}
 	delete[] node.Objs_;
 	delete[] child_;
-	child_ = new Node[8];
-	for (int i = 0; i < 8; i++) {
+	mask_ = node.mask_;
+	child_ = mask_ ? new Node<Tname, Layout>*[numChildren()] : nullptr;
+	for (int i = 0; i < numChildren(); i++) {
 		child_[i] = node.child_[i];
 	}
 	delete[] parent_;
@@ -322,239 +829,251 @@ Node<Tname>& Node<Tname>::operator = (const Node<Tname>& node) {  // Node copy a
 	xMax_ = node.xMax_; xMin_ = node.xMin_; yMax_ = node.yMax_; yMin_ = node.yMin_; zMax_ = node.zMax_; zMin_ = node.zMin_;
 	num_ = node.num_;
 	depth_ = node.depth_;
+	contMin_ = node.contMin_; contMax_ = node.contMax_;
 	leaf_ = node.leaf_;
+	split_ = node.split_;
+	payload_ = node.payload_;
 	return *this;
 }
 
 // Node move constructors
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <moveable>
-Node<Tname>::Node(Node<Tname>&& node) {  // Node move constructor
+Node<Tname, Layout>::Node(Node<Tname, Layout>&& node) {  // Node move constructor
 	x_ = node.x_; y_ = node.y_; z_ = node.z_;
 	xMax_ = node.xMax_; xMin_ = node.xMin_; yMax_ = node.yMax_; yMin_ = node.yMin_; zMax_ = node.zMax_; zMin_ = node.zMin_;
 	num_ = node.num_;
 	depth_ = node.depth_;
+	contMin_ = node.contMin_; contMax_ = node.contMax_;
 	leaf_ = node.leaf_;
+	split_ = node.split_;
+	payload_ = std::move(node.payload_);
 	Objs_ = std::move(node.Objs_);
 	parent_ = std::move(node.parent_);
-	for (int i = 0; i < 8; i++) {
-		child_[i] = std::move(node.child_[i]);
-	}
+	child_ = node.child_; mask_ = node.mask_;
 	node.x_ = 0; node.y_ = 0; node.z_ = 0;
 	node.xMax_ = 0; node.xMin_ = 0; node.yMax_ = 0; node.yMin_ = 0; node.zMax_ = 0; node.zMin_ = 0;
 	node.num_ = 0;
 	node.depth_ = 0;
+	node.contMin_ = node.contMax_ = vec3{ 0, 0, 0 };
 	node.leaf_ = false;
 	node.Objs_ = nullptr;
 	node.parent_ = nullptr;
-	for (int i = 0; i < 8; i++) {
-		node.child_[i] = nullptr;
-	}
+	node.child_ = nullptr; node.mask_ = 0;
 
 }
 
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <copyableOnly>
-Node<Tname>::Node(Node<Tname>&& node) {  // Node move constructor
-	std::cout << "Moving Node, copying Objects." << std::endl;
+Node<Tname, Layout>::Node(Node<Tname, Layout>&& node) {  // Node move constructor, objects can't be moved so they are copied
 	x_ = node.x_; y_ = node.y_; z_ = node.z_;
 	xMax_ = node.xMax_; xMin_ = node.xMin_; yMax_ = node.yMax_; yMin_ = node.yMin_; zMax_ = node.zMax_; zMin_ = node.zMin_;
 	num_ = node.num_;
 	depth_ = node.depth_;
+	contMin_ = node.contMin_; contMax_ = node.contMax_;
 	leaf_ = node.leaf_;
+	split_ = node.split_;
+	payload_ = std::move(node.payload_);
 	Objs_ = node.Objs_;
 	parent_ = std::move(node.parent_);
-	for (int i = 0; i < 8; i++) {
-		child_[i] = std::move(node.child_[i]);
-	}
+	child_ = node.child_; mask_ = node.mask_;
 	node.x_ = 0; node.y_ = 0; node.z_ = 0;
 	node.xMax_ = 0; node.xMin_ = 0; node.yMax_ = 0; node.yMin_ = 0; node.zMax_ = 0; node.zMin_ = 0;
 	node.num_ = 0;
 	node.depth_ = 0;
+	node.contMin_ = node.contMax_ = vec3{ 0, 0, 0 };
 	node.leaf_ = false;
 	node.Objs_ = nullptr;
 	node.parent_ = nullptr;
-	for (int i = 0; i < 8; i++) {
-		node.child_[i] = nullptr;
-	}
+	node.child_ = nullptr; node.mask_ = 0;
 
 }
 
 // Node move assign operators
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <moveable>
-Node<Tname>& Node<Tname>::operator = (Node<Tname>&& node) {  // Node move assignment operator
+Node<Tname, Layout>& Node<Tname, Layout>::operator = (Node<Tname, Layout>&& node) {  // Node move assignment operator
 	std::swap(x_, node.x_); std::swap(y_, node.y_); std::swap(z_, node.z_);
 	std::swap(xMax_, node.xMax_); std::swap(yMax_, node.yMax_); std::swap(zMax_, node.zMax_);
 	std::swap(xMin_, node.xMin_); std::swap(yMin_, node.yMin_); std::swap(zMin_, node.zMin_);
 	std::swap(num_, node.num_);
 	std::swap(depth_, node.depth_);
+	std::swap(contMin_, node.contMin_); std::swap(contMax_, node.contMax_);
 	std::swap(leaf_, node.leaf_);
+	std::swap(split_, node.split_);
+	std::swap(payload_, node.payload_);
 	std::swap(Objs_, node.Objs_);
 	std::swap(parent_, node.parent_);
-	for (int i = 0; i < 8; i++) {
-		std::swap(child_[i], node.child_[i]);
-	}
+	std::swap(child_, node.child_); std::swap(mask_, node.mask_);
 	return *this;
 }
 
-template <typename Tname>
+template <typename Tname, typename Layout>
 template <copyableOnly>
-Node<Tname>& Node<Tname>::operator = (Node<Tname>&& node) {  // Node move assignment operator
-	std::cout << "Moving Node, copying Objects." << std::endl;
+Node<Tname, Layout>& Node<Tname, Layout>::operator = (Node<Tname, Layout>&& node) {  // Node move assignment operator, objects can't be moved so they are copied
 	std::swap(x_, node.x_); std::swap(y_, node.y_); std::swap(z_, node.z_);
 	std::swap(xMax_, node.xMax_); std::swap(yMax_, node.yMax_); std::swap(zMax_, node.zMax_);
 	std::swap(xMin_, node.xMin_); std::swap(yMin_, node.yMin_); std::swap(zMin_, node.zMin_);
 	std::swap(num_, node.num_);
 	std::swap(depth_, node.depth_);
+	std::swap(contMin_, node.contMin_); std::swap(contMax_, node.contMax_);
 	std::swap(leaf_, node.leaf_);
+	std::swap(split_, node.split_);
+	std::swap(payload_, node.payload_);
 	Objs_ = node.Objs_; delete[] node.Objs_; node.Objs_ = nullptr;
 	std::swap(parent_, node.parent_);
-	for (int i = 0; i < 8; i++) {
-		std::swap(child_[i], node.child_[i]);
-	}
+	std::swap(child_, node.child_); std::swap(mask_, node.mask_);
 	return *this;
 }
 
 
 
 // Octree constructors/destructor
-template <typename Tname> Octree<Tname>::Octree() {
-	root_ = new Node<Tname>();
+template <typename Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>::Octree() {
+	root_ = new Node<Tname, Layout>();
 	maxDepth_ = 0;
 	maxLeaf_ = 0;
 }
 
-template <typename Tname> Octree<Tname>::Octree(Tname* Objects, objToCoord funcToPlace, int objArrSize, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax) {
+template <typename Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>::Octree(Tname* Objects, objToCoord funcToPlace, int objArrSize, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax) {
 	setFunc(funcToPlace);
 	maxDepth_ = maxDepth;
 	maxLeaf_ = maxLeafSize;
-	root_ = new Node<Tname>(Objects, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xMax, xMin, yMax, yMin, zMax, zMin, objArrSize, -1, false);  // make root
+	root_ = new Node<Tname, Layout>(Objects, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xMax, xMin, yMax, yMin, zMax, zMin, objArrSize, -1, false);  // make root
 //	*root_ = { nullptr,{ nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr }, nullptr, 0, 0, 0, 0, 0, 0, 0, 0, 0, objArrSize, 0 };  // initialise Node
 //	root_->Objs_ = Objects;  // assign root object array
 	build(root_);  // build root children
 }
 
-template <typename Tname> Octree<Tname>::~Octree() {  // Default destructor
+template <typename Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>::Octree(Tname* Objects, objToCoordCtx funcToPlace, const void* context, int objArrSize, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax) {
+	func = nullptr;
+	funcCtx = funcToPlace;
+	funcContext = context;
+	maxDepth_ = maxDepth;
+	maxLeaf_ = maxLeafSize;
+	root_ = new Node<Tname, Layout>(Objects, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xMax, xMin, yMax, yMin, zMax, zMin, objArrSize, -1, false);  // make root
+	build(root_);  // build root children
+}
+
+template <typename Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>::Octree(Tname* Objects, objToBox boxToPlace, int objArrSize, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax) {
+	func = nullptr;
+	boxFunc = boxToPlace;  // objects are placed by their box centre, loose content bounds hold the whole boxes
+	maxDepth_ = maxDepth;
+	maxLeaf_ = maxLeafSize;
+	root_ = new Node<Tname, Layout>(Objects, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xMax, xMin, yMax, yMin, zMax, zMin, objArrSize, -1, false);  // make root
+	build(root_);  // build root children
+}
+
+template <typename Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>::~Octree() {  // Default destructor
 	if (root_) {
 		delete root_;  // calls Node destructor
 	}
+	delete[] insertBuckets_.load();
 }
 
 // Octree copy constructors
-template <typename Tname>
-template <copyable>
-Octree<Tname>::Octree(const Octree<Tname>& O) {  // Octree copy constructor
-	root_ = 0; root_ = O.getRoot();  // Copy root
-	maxDepth_ = O.maxDepth_; maxLeaf_ = O.maxLeaf_;
-	func = O.func;  // set function
-	Tname* ObjArr = O.copyTreeData(root_);  // get object array (through copy)
-	root_->Objs_ = ObjArr;
-	build(root_);  // build tree
+template <typename Tname, typename Instr, typename Layout>
+Octree<Tname, Instr, Layout>::Octree(const Octree<Tname, Instr, Layout>& O) requires copyable<Tname> {  // Octree copy constructor
+	Instr::count(OctreeCounter::TreeCopies);
+	root_ = nullptr;
+	cloneFrom(O);  // copy nodes and leaf objects as they are, no rebuild
 }
 
-template <typename Tname>
-template <moveableOnly>
-Octree<Tname>::Octree(const Octree<Tname>& O) {  // Octree copy constructor
-	std::cout << "Copying Octree, moving Objects." << std::endl;
-	root_ = 0; root_ = O.getRoot();  // Copy root
-	maxDepth_ = O.maxDepth_; maxLeaf_ = O.maxLeaf_;
-	func = O.func;  // set function
-	Tname* ObjArr = O.moveTreeData(root_);  // get object array (through move)
-	root_->Objs_ = ObjArr;
-	build(root_);  // build tree
+template <typename Tname, typename Instr, typename Layout>
+Octree<Tname, Instr, Layout>::Octree(const Octree<Tname, Instr, Layout>& O) requires moveableOnly<Tname> {  // Octree copy constructor
+	Instr::count(OctreeCounter::TreeMoves);  // objects can't be copied, so this is a move
+	root_ = nullptr;
+	takeNodes(const_cast<Octree<Tname, Instr, Layout>&>(O));  // objects can't be copied, so the node hierarchy is taken over whole
 }
 
 // Octree copy assign operators
-template <typename Tname>
-template <copyable>
-Octree<Tname>& Octree<Tname>::operator = (const Octree<Tname>& O) {  // Octree copy assignment operator
+template <typename Tname, typename Instr, typename Layout>
+Octree<Tname, Instr, Layout>& Octree<Tname, Instr, Layout>::operator = (const Octree<Tname, Instr, Layout>& O) requires copyable<Tname> {  // Octree copy assignment operator
 	if (&O == this) return *this;  // no self assignment
-	delete root_;
-	root_ = nullptr;
-	maxDepth_ = 0; maxLeaf_ = 0; // delete this object�s array
-	Tname* ObjArr = O.copyTreeData(O.getRoot());
-	root_ = new Node<Tname>(ObjArr, nullptr, nullptr, nullptr,
-		nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		O.getRoot()->num_, 0, 0, false);
-	delete[] ObjArr;
-	maxDepth_ = O.maxDepth_; maxLeaf_ = O.maxLeaf_;
-	func = O.func;
-	build(root_);
-	std::cout << "Copying Octree." << std::endl;
+	Instr::count(OctreeCounter::TreeCopies);
+	cloneFrom(O);  // copy nodes and leaf objects as they are, no rebuild
 	return *this;
 }
 
-template <typename Tname>
-template <moveableOnly>
-Octree<Tname>& Octree<Tname>::operator = (const Octree<Tname>& O) {  // Octree copy assignment operator
+template <typename Tname, typename Instr, typename Layout>
+Octree<Tname, Instr, Layout>& Octree<Tname, Instr, Layout>::operator = (const Octree<Tname, Instr, Layout>& O) requires moveableOnly<Tname> {  // Octree copy assignment operator
 	if (&O == this) return *this;  // no self assignment
-	delete root_;
-	root_ = nullptr;
-	maxDepth_ = 0; maxLeaf_ = 0; // delete this object�s array
-	Tname* ObjArr = O.moveTreeData(O.getRoot());
-	root_ = new Node<Tname>(ObjArr, nullptr, nullptr, nullptr,
-		nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		O.getRoot()->num_, 0, 0, false);
-	delete[] ObjArr;
-	maxDepth_ = O.maxDepth_; maxLeaf_ = O.maxLeaf_;
-	func = O.func;
-	build(root_);
-	std::cout << "Copying Octree, moving Objects." << std::endl;
+	Instr::count(OctreeCounter::TreeMoves);
+	takeNodes(const_cast<Octree<Tname, Instr, Layout>&>(O));  // objects can't be copied, so the node hierarchy is taken over whole
 	return *this;
 }
 
 // Octree move constructor & assign operator
-template <typename Tname> Octree<Tname>::Octree(Octree<Tname>&& O) {  // Octree move constructor
-	std::cout << "Move constructor for Octree called" << std::endl;
+template <typename Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>::Octree(Octree<Tname, Instr, Layout>&& O) {  // Octree move constructor, O is left an empty tree with its bounds and settings
+	Instr::count(OctreeCounter::TreeMoves);
 	maxDepth_ = O.maxDepth_; maxLeaf_ = O.maxLeaf_;
+	func = O.func; funcCtx = O.funcCtx; funcContext = O.funcContext; boxFunc = O.boxFunc;
+	syncModel_ = O.syncModel_; lastSync_ = O.lastSync_;
+	staged_ = std::move(O.staged_);
+	insertBuckets_.store(O.insertBuckets_.exchange(nullptr));
 	root_ = O.root_;
-	O.maxDepth_ = 0; O.maxLeaf_ = 0;
-	O.root_ = 0;
+	nodeTable_ = std::move(O.nodeTable_); tableShift_ = O.tableShift_; tableHint_ = O.tableHint_;
+	O.root_ = new Node<Tname, Layout>();
+	if (root_) {
+		O.root_->xMax_ = root_->xMax_; O.root_->xMin_ = root_->xMin_; O.root_->yMax_ = root_->yMax_; O.root_->yMin_ = root_->yMin_; O.root_->zMax_ = root_->zMax_; O.root_->zMin_ = root_->zMin_;
+		O.root_->depth_ = root_->depth_;
+	}
+	O.staged_.clear();
+	O.nodeTable_.clear(); O.tableShift_ = 0; O.tableHint_ = 0;
 }
 
-template <typename Tname> Octree<Tname>& Octree<Tname>::operator = (Octree<Tname>&& O) {  // Octree move assignment operator
-	std::cout << "Octree move assignment" << std::endl;
+template <typename Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>& Octree<Tname, Instr, Layout>::operator = (Octree<Tname, Instr, Layout>&& O) {  // Octree move assignment operator, O is left holding this tree's old contents
+	if (&O == this) return *this;  // no self assignment
+	Instr::count(OctreeCounter::TreeMoves);
 	std::swap(maxDepth_, O.maxDepth_); std::swap(maxLeaf_, O.maxLeaf_);
+	std::swap(func, O.func); std::swap(funcCtx, O.funcCtx); std::swap(funcContext, O.funcContext); std::swap(boxFunc, O.boxFunc);
+	std::swap(syncModel_, O.syncModel_); std::swap(lastSync_, O.lastSync_);
+	std::swap(staged_, O.staged_);
+	insertBuckets_.store(O.insertBuckets_.exchange(insertBuckets_.load()));
 	std::swap(root_, O.root_);
+	std::swap(nodeTable_, O.nodeTable_); std::swap(tableShift_, O.tableShift_); std::swap(tableHint_, O.tableHint_);
 	return *this;
 }
 
 // Octree getter functions
-template <typename Tname> Node<Tname>* Octree<Tname>::getNode(const int depth, const double X, const double Y, const double Z) const {
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::getNode(const int depth, const double X, const double Y, const double Z) const {
 	int curdepth = 0;
-	Node<Tname>* node = root_;
+	Node<Tname, Layout>* node = root_;
 	if (depth < maxDepth_) {
 		while ((curdepth != depth) && (node->num_ > maxLeaf_)) {  // while not at required depth
-			double xCent = (node->xMax_ + node->xMin_) / 2;
-			double yCent = (node->yMax_ + node->yMin_) / 2;
-			double zCent = (node->zMax_ + node->zMin_) / 2;
+			vec3 split = node->getSplit();
+			double xCent = split.x_, yCent = split.y_, zCent = split.z_;
 			bool front = X <= xCent;  // Determine node to travel to
 			bool left = Y <= yCent;
-			bool bottom = Z <= zCent;
+			bool bottom = Layout::dims < 3 || Z <= zCent;  // quadtrees only use the bottom octants
 			if (left && front && bottom) {  // child_[0]
-				node = node->child_[0];
+				node = node->getChild(0);
 			}
 			else if (!left && front && bottom) {  // 1
-				node = node->child_[1];
+				node = node->getChild(1);
 			}
 			else if (left && !front && bottom) {  // 2
-				node = node->child_[2];
+				node = node->getChild(2);
 			}
 			else if (!left && !front && bottom) {  // 3
-				node = node->child_[3];
+				node = node->getChild(3);
 			}
 			else if (left && front && !bottom) {  // 4
-				node = node->child_[4];
+				node = node->getChild(4);
 			}
 			else if (!left && front && !bottom) {  // 5
-				node = node->child_[5];
+				node = node->getChild(5);
 			}
 			else if (left && !front && !bottom) {  // 6
-				node = node->child_[6];
+				node = node->getChild(6);
 			}
 			else {  // 7
-				node = node->child_[7];
+				node = node->getChild(7);
+			}
+			Instr::count(OctreeCounter::NodesVisited);
+			if (!node) {  // absent child_, nothing is stored there
+				std::cout << "There is no Node at this position, the region is empty." << std::endl;
+				return nullptr;
 			}
 			curdepth++;
 		}
@@ -568,85 +1087,126 @@ template <typename Tname> Node<Tname>* Octree<Tname>::getNode(const int depth, c
 	return node;
 }
 
-template <typename Tname> int Octree<Tname>::getDataSize(Node<Tname>* node, bool homeNode) {
-	static int size;  // return the number of objects in a node's children
-	if (homeNode) {
-		homeNode = false;
-		size = 0;
+template <typename Tname, typename Instr, typename Layout> int Octree<Tname, Instr, Layout>::getDataSize(Node<Tname, Layout>* node, bool) const {
+	int size = 0;  // return the number of objects in a node's children (local, so concurrent readers don't share it)
+	Instr::count(OctreeCounter::NodesVisited);
+	if (!node->hasChildren()) {  // leaf or empty node
+		return node->num_;
 	}
-	for (int i = 0; i < 8; i++) {  // Iterating over the child_ nodes
-		if (node->child_[i]->num_ > maxLeaf_ && node->child_[i]->depth_ != maxDepth_) {
-			getDataSize(node->child_[i], homeNode);  // repeat process with child_ nodes
-		}
-		else {
-			size = size + node->child_[i]->num_;
-		}
+	for (int i = 0; i < node->numChildren(); i++) {  // Iterating over the present child_ nodes
+		size = size + getDataSize(node->child_[i]);  // repeat process with child_ nodes
 	}
 	return size;
 }
 
 
-template <typename Tname> Node<Tname>* Octree<Tname>::findLeafNode(const double X, const double Y, const double Z) const {
-	Node<Tname>* node = root_;
-	if (X > node->xMax_ || X < node->xMin_ || Y > node->yMax_ || Y < node->yMin_ || Z > node->zMax_ || Z < node->zMin_) {
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::findLeafNode(const double X, const double Y, const double Z) const {
+	Node<Tname, Layout>* node = root_;
+	if (!node->contains(vec3{ X, Y, Z })) {
 		return nullptr; // Coordinates are out of bounds of the octree, return nullptr
 	}
 	while (node->leaf_ == false) {  // while not at a leaf node
+		Instr::count(OctreeCounter::NodesVisited);
 		if (node->num_ == 0) { break; }  // At an empty node, return the empty node
-		double xCent = (node->xMax_ + node->xMin_) / 2;
-		double yCent = (node->yMax_ + node->yMin_) / 2;
-		double zCent = (node->zMax_ + node->zMin_) / 2;
+		vec3 split = node->getSplit();
+		double xCent = split.x_, yCent = split.y_, zCent = split.z_;
 		bool front = X <= xCent;  // Determine node to travel to
 		bool left = Y <= yCent;
-		bool bottom = Z <= zCent;
+		bool bottom = Layout::dims < 3 || Z <= zCent;
 		if (left) {
 			if (front) {
 				if (bottom) {
-					node = node->child_[0];
+					node = node->getChild(0);
 				}
 				else {
-					node = node->child_[4];
+					node = node->getChild(4);
 				}
 			}
 			else {
 				if (bottom) {
-					node = node->child_[2];
+					node = node->getChild(2);
 				}
 				else {
-					node = node->child_[6];
+					node = node->getChild(6);
 				}
 			}
 		}
 		else {
 			if (front) {
 				if (bottom) {
-					node = node->child_[1];
+					node = node->getChild(1);
 				}
 				else {
-					node = node->child_[5];
+					node = node->getChild(5);
 				}
 			}
 			else {
 				if (bottom) {
-					node = node->child_[3];
+					node = node->getChild(3);
 				}
 				else {
-					node = node->child_[7];
+					node = node->getChild(7);
 				}
 			}
 		}
+		if (!node) { return nullptr; }  // absent child_, the region holds no objects
 	}
 	return node;
 }
 
 // Octee build functions
-template <typename Tname>
+template <typename Tname, typename Instr, typename Layout> vec3 Octree<Tname, Instr, Layout>::chooseSplit(Node<Tname, Layout>* node, const vec3* V) {
+	vec3 split{ (node->xMax_ + node->xMin_) / 2, (node->yMax_ + node->yMin_) / 2, (node->zMax_ + node->zMin_) / 2 };
+	if constexpr (Layout::split != SplitRule::Midpoint) {
+		int num = node->num_;
+		double lo[3] = { node->xMin_, node->yMin_, node->zMin_ };
+		double hi[3] = { node->xMax_, node->yMax_, node->zMax_ };
+		double* plane[3] = { &split.x_, &split.y_, &split.z_ };
+		std::vector<double> vals(num);
+		for (int axis = 0; axis < Layout::dims && num > 0; axis++) {  // each axis is placed on its own
+			for (int i = 0; i < num; i++) {
+				vals[i] = (axis == 0) ? V[i].x_ : (axis == 1) ? V[i].y_ : V[i].z_;
+			}
+			double s = *plane[axis];
+			if (Layout::split == SplitRule::Median) {  // lower median, objects on the plane go to the lower cell
+				auto mid = vals.begin() + (num - 1) / 2;
+				std::nth_element(vals.begin(), mid, vals.end());
+				s = *mid;
+			}
+			else {  // binned surface area heuristic over the objects' extent, minimising area * objects summed over both sides
+				const int bins = 32;
+				int counts[bins] = {};
+				auto [minIt, maxIt] = std::minmax_element(vals.begin(), vals.end());
+				double vMin = *minIt, width = *maxIt - *minIt;
+				for (int i = 0; i < num; i++) {
+					counts[(width > 0) ? std::clamp((int)((vals[i] - vMin) / width * bins), 0, bins - 1) : 0]++;
+				}
+				double e1 = hi[(axis + 1) % 3] - lo[(axis + 1) % 3], e2 = hi[(axis + 2) % 3] - lo[(axis + 2) % 3];
+				if (Layout::dims < 3) { e1 = hi[1 - axis] - lo[1 - axis]; e2 = 0; }
+				auto area = [e1, e2](double len) { return (Layout::dims == 3) ? len * (e1 + e2) + e1 * e2 : len + e1; };  // half the surface area, or perimeter in 2D
+				double bestCost = -1;
+				for (int k = 0, below = 0; k <= bins; k++) {  // the end planes cut off the empty space around the objects
+					double t = vMin + width * k / bins;
+					if (k > 0) { below += counts[k - 1]; }
+					if (t <= lo[axis] || t >= hi[axis]) { continue; }
+					double cost = area(t - lo[axis]) * below + area(hi[axis] - t) * (num - below);
+					if (bestCost < 0 || cost < bestCost) { bestCost = cost; s = t; }
+				}
+			}
+			if (s > lo[axis] && s < hi[axis]) { *plane[axis] = s; }  // a plane on the cell boundary would leave every object on one side
+		}
+		node->split_ = split;
+	}
+	return split;
+}
+
+template <typename Tname, typename Instr, typename Layout>
 template<copyableOnly>
-void Octree<Tname>::build(Node<Tname>* node, int depth) {
+void Octree<Tname, Instr, Layout>::build(Node<Tname, Layout>* node, int depth) {
 	depth++;
 	vec3* V = new vec3[node->num_];
 	for (int i = 0; i < node->num_; i++) {  // Calculate c.o.d. of Node by producing array of vec3=length of object array
-		V[i] = func(node->Objs_[i]);  // using function provided get obj coords
+		V[i] = getCoords(node->Objs_[i]);  // using function provided get obj coords
 		if (node == root_) {
 			if (i == 0) {  // First iteration, set limits
 				if (root_->xMin_ == root_->xMax_ && root_->yMin_ == root_->yMax_ && root_->zMin_ == root_->zMax_) {  // If root limits aren't preset
@@ -669,9 +1229,8 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 	if (node->num_ > 0) {
 		node->setX(node->x_ / node->num_); node->setY(node->y_ / node->num_); node->setZ(node->z_ / node->num_);
 	}
-	double xCent = (node->xMax_ + node->xMin_) / 2;
-	double yCent = (node->yMax_ + node->yMin_) / 2;
-	double zCent = (node->zMax_ + node->zMin_) / 2;
+	vec3 split = chooseSplit(node, V);  // the cell midpoint unless the layout picks adaptive split planes
+	double xCent = split.x_, yCent = split.y_, zCent = split.z_;
 
 	int Total = node->num_;
 	Tname* Ob0, * Ob1, * Ob2, * Ob3, * Ob4, * Ob5, * Ob6, * Ob7;
@@ -679,7 +1238,7 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 	for (int i = 0; i < Total; i++) {  // Get sizes of each box
 		bool front = V[i].x_ <= xCent;
 		bool left = V[i].y_ <= yCent;
-		bool bottom = V[i].z_ <= zCent;
+		bool bottom = Layout::dims < 3 || V[i].z_ <= zCent;
 		if (left && front && bottom) {
 			BLF++;
 		}
@@ -711,7 +1270,7 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 	for (int i = 0; i < Total; i++) {  // Copy over relevant particles
 		bool front = V[i].x_ <= xCent;
 		bool left = V[i].y_ <= yCent;
-		bool bottom = V[i].z_ <= zCent;
+		bool bottom = Layout::dims < 3 || V[i].z_ <= zCent;
 		if (left && front && bottom) {  // particles sent to correct child_ node
 			Ob0[BLF - 1] = node->Objs_[i];
 			BLF--;
@@ -745,27 +1304,26 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 			TRB--;
 		}
 	}
-	// Create and initialise child_ nodes with pointers to the parent_ node and relevant object arrays
+	// Create and initialise child_ nodes for the non-empty octants, with pointers to the parent_ node and relevant object arrays
+	Node<Tname, Layout>* children[8] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
 	// Node(Objects, child0, child1, child2, child3, child4, child5, child6, child7, parent, x, y, z, xMax, xMin, yMax, yMin, zMax, zMin, num, depth, leaf);
-	node->child_[0] = new Node<Tname>(Ob0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, zCent, node->zMin_, num0, depth, false);
-	node->child_[1] = new Node<Tname>(Ob1, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, zCent, node->zMin_, num1, depth, false);
-	node->child_[2] = new Node<Tname>(Ob2, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, zCent, node->zMin_, num2, depth, false);
-	node->child_[3] = new Node<Tname>(Ob3, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, zCent, node->zMin_, num3, depth, false);
-	node->child_[4] = new Node<Tname>(Ob4, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, node->zMax_, zCent, num4, depth, false);
-	node->child_[5] = new Node<Tname>(Ob5, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, node->zMax_, zCent, num5, depth, false);
-	node->child_[6] = new Node<Tname>(Ob6, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, node->zMax_, zCent, num6, depth, false);
-	node->child_[7] = new Node<Tname>(Ob7, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, node->zMax_, zCent, num7, depth, false);
-	node->child_[0]->parent_ = node;
-	node->child_[1]->parent_ = node;
-	node->child_[2]->parent_ = node;
-	node->child_[3]->parent_ = node;
-	node->child_[4]->parent_ = node;
-	node->child_[5]->parent_ = node;
-	node->child_[6]->parent_ = node;
-	node->child_[7]->parent_ = node;
+	if (num0 > 0) { children[0] = new Node<Tname, Layout>(Ob0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, zCent, node->zMin_, num0, depth, false); }
+	if (num1 > 0) { children[1] = new Node<Tname, Layout>(Ob1, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, zCent, node->zMin_, num1, depth, false); }
+	if (num2 > 0) { children[2] = new Node<Tname, Layout>(Ob2, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, zCent, node->zMin_, num2, depth, false); }
+	if (num3 > 0) { children[3] = new Node<Tname, Layout>(Ob3, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, zCent, node->zMin_, num3, depth, false); }
+	if (num4 > 0) { children[4] = new Node<Tname, Layout>(Ob4, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, node->zMax_, zCent, num4, depth, false); }
+	if (num5 > 0) { children[5] = new Node<Tname, Layout>(Ob5, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, node->zMax_, zCent, num5, depth, false); }
+	if (num6 > 0) { children[6] = new Node<Tname, Layout>(Ob6, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, node->zMax_, zCent, num6, depth, false); }
+	if (num7 > 0) { children[7] = new Node<Tname, Layout>(Ob7, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, node->zMax_, zCent, num7, depth, false); }
+	node->setChildren(children);  // absent octants take no memory and are skipped by every traversal
+	Instr::count(OctreeCounter::Allocations, 8 + node->numChildren());  // octant arrays and child nodes
+	countTransfers(2 * (uint64_t)Total);  // into the octant arrays, then into the children
+	for (int i = 0; i < node->numChildren(); i++) {
+		node->child_[i]->parent_ = node;
+	}
 	delete[] V;  // delete array of obj coords
 	delete[] Ob0; delete[] Ob1; delete[] Ob2; delete[] Ob3; delete[] Ob4; delete[] Ob5; delete[] Ob6; delete[] Ob7;
-	for (int i = 0; i < 8; i++) {
+	for (int i = 0; i < node->numChildren(); i++) {
 		if ((node->child_[i]->num_ > maxLeaf_) && (depth != maxDepth_)) {  // If there is a significant number of particles in box and not at max depth
 			build(node->child_[i], depth);  // repeat process with child_ nodes
 		}
@@ -774,15 +1332,16 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 				node->child_[i]->Objs_ = nullptr;
 				continue;
 			}  // leaf case
+			node->child_[i]->leaf_ = true;
+			if (!Layout::centreOfData) { continue; }  // the coordinates are only needed again for the c.o.d.
 			vec3* V = new vec3[node->child_[i]->num_];  // get child_ c.o.d. coords
 			std::pair<vec3, double> result;
 			for (int j = 0; j < node->child_[i]->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
-				V[j] = func(node->child_[i]->Objs_[j]);
+				V[j] = getCoords(node->child_[i]->Objs_[j]);
 				node->child_[i]->x_ += V[j].x_;
 				node->child_[i]->y_ += V[j].y_;
 				node->child_[i]->z_ += V[j].z_;
 			}
-			node->child_[i]->leaf_ = true;
 			delete[] V;
 			if (node->child_[i]->num_ > 0) {  // set c.o.d.
 				node->child_[i]->setX(node->child_[i]->x_ / node->child_[i]->num_);
@@ -792,21 +1351,19 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 		}
 	}
 
-	if (node->num_ > maxLeaf_) {  // If there is a significant number of particles in box
-		if (depth != maxDepth_) {  // and depth is not child_ node depth (and hence definitely not a leaf node)
-			if (node->Objs_) { delete[] node->Objs_; }  // delete node objects, freeing up memory
-			node->Objs_ = nullptr;
-		}
+	if (node->hasChildren()) {  // children hold the objects now, including children at maxDepth
+		if (node->Objs_) { delete[] node->Objs_; }  // delete node objects, freeing up memory
+		node->Objs_ = nullptr;
 	}
 }
 
-template <typename Tname>
+template <typename Tname, typename Instr, typename Layout>
 template<moveable>
-void Octree<Tname>::build(Node<Tname>* node, int depth) {
+void Octree<Tname, Instr, Layout>::build(Node<Tname, Layout>* node, int depth) {
 	depth++;
 	vec3* V = new vec3[node->num_];
 	for (int i = 0; i < node->num_; i++) {  // Calculate c.o.d. of Node by producing array of vec3=length of object array
-		V[i] = func(node->Objs_[i]);  // using function provided get obj coords
+		V[i] = getCoords(node->Objs_[i]);  // using function provided get obj coords
 		if (node == root_) {
 			if (i == 0) {  // First iteration, set limits
 				if (root_->xMin_ == root_->xMax_ && root_->yMin_ == root_->yMax_ && root_->zMin_ == root_->zMax_) {  // If root limits aren't preset
@@ -829,9 +1386,8 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 	if (node->num_ > 0) {
 		node->setX(node->x_ / node->num_); node->setY(node->y_ / node->num_); node->setZ(node->z_ / node->num_);
 	}
-	double xCent = (node->xMax_ + node->xMin_) / 2;
-	double yCent = (node->yMax_ + node->yMin_) / 2;
-	double zCent = (node->zMax_ + node->zMin_) / 2;
+	vec3 split = chooseSplit(node, V);  // the cell midpoint unless the layout picks adaptive split planes
+	double xCent = split.x_, yCent = split.y_, zCent = split.z_;
 
 	int Total = node->num_;
 	Tname* Ob0, * Ob1, * Ob2, * Ob3, * Ob4, * Ob5, * Ob6, * Ob7;
@@ -839,7 +1395,7 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 	for (int i = 0; i < Total; i++) {  // Get sizes of each box
 		bool front = V[i].x_ <= xCent;
 		bool left = V[i].y_ <= yCent;
-		bool bottom = V[i].z_ <= zCent;
+		bool bottom = Layout::dims < 3 || V[i].z_ <= zCent;
 		if (left && front && bottom) {
 			BLF++;
 		}
@@ -871,7 +1427,7 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 	for (int i = 0; i < Total; i++) {  // Copy over relevant particles
 		bool front = V[i].x_ <= xCent;
 		bool left = V[i].y_ <= yCent;
-		bool bottom = V[i].z_ <= zCent;
+		bool bottom = Layout::dims < 3 || V[i].z_ <= zCent;
 		if (left && front && bottom) {  // particles sent to correct child_ node
 			Ob0[BLF - 1] = std::move(node->Objs_[i]);
 			BLF--;
@@ -905,27 +1461,26 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 			TRB--;
 		}
 	}
-	// Create and initialise child_ nodes with pointers to the parent_ node and relevant object arrays
+	// Create and initialise child_ nodes for the non-empty octants, with pointers to the parent_ node and relevant object arrays
+	Node<Tname, Layout>* children[8] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
 	// Node(Objects, child0, child1, child2, child3, child4, child5, child6, child7, parent, x, y, z, xMax, xMin, yMax, yMin, zMax, zMin, num, depth, leaf);
-	node->child_[0] = new Node<Tname>(Ob0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, zCent, node->zMin_, num0, depth, false);
-	node->child_[1] = new Node<Tname>(Ob1, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, zCent, node->zMin_, num1, depth, false);
-	node->child_[2] = new Node<Tname>(Ob2, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, zCent, node->zMin_, num2, depth, false);
-	node->child_[3] = new Node<Tname>(Ob3, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, zCent, node->zMin_, num3, depth, false);
-	node->child_[4] = new Node<Tname>(Ob4, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, node->zMax_, zCent, num4, depth, false);
-	node->child_[5] = new Node<Tname>(Ob5, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, node->zMax_, zCent, num5, depth, false);
-	node->child_[6] = new Node<Tname>(Ob6, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, node->zMax_, zCent, num6, depth, false);
-	node->child_[7] = new Node<Tname>(Ob7, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, node->zMax_, zCent, num7, depth, false);
-	node->child_[0]->parent_ = node;
-	node->child_[1]->parent_ = node;
-	node->child_[2]->parent_ = node;
-	node->child_[3]->parent_ = node;
-	node->child_[4]->parent_ = node;
-	node->child_[5]->parent_ = node;
-	node->child_[6]->parent_ = node;
-	node->child_[7]->parent_ = node;
+	if (num0 > 0) { children[0] = new Node<Tname, Layout>(Ob0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, zCent, node->zMin_, num0, depth, false); }
+	if (num1 > 0) { children[1] = new Node<Tname, Layout>(Ob1, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, zCent, node->zMin_, num1, depth, false); }
+	if (num2 > 0) { children[2] = new Node<Tname, Layout>(Ob2, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, zCent, node->zMin_, num2, depth, false); }
+	if (num3 > 0) { children[3] = new Node<Tname, Layout>(Ob3, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, zCent, node->zMin_, num3, depth, false); }
+	if (num4 > 0) { children[4] = new Node<Tname, Layout>(Ob4, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, yCent, node->yMin_, node->zMax_, zCent, num4, depth, false); }
+	if (num5 > 0) { children[5] = new Node<Tname, Layout>(Ob5, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, xCent, node->xMin_, node->yMax_, yCent, node->zMax_, zCent, num5, depth, false); }
+	if (num6 > 0) { children[6] = new Node<Tname, Layout>(Ob6, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, yCent, node->yMin_, node->zMax_, zCent, num6, depth, false); }
+	if (num7 > 0) { children[7] = new Node<Tname, Layout>(Ob7, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 0, node->xMax_, xCent, node->yMax_, yCent, node->zMax_, zCent, num7, depth, false); }
+	node->setChildren(children);  // absent octants take no memory and are skipped by every traversal
+	Instr::count(OctreeCounter::Allocations, 8 + node->numChildren());  // octant arrays and child nodes
+	countTransfers(2 * (uint64_t)Total);  // into the octant arrays, then into the children
+	for (int i = 0; i < node->numChildren(); i++) {
+		node->child_[i]->parent_ = node;
+	}
 	delete[] V;  // delete array of obj coords
 	delete[] Ob0; delete[] Ob1; delete[] Ob2; delete[] Ob3; delete[] Ob4; delete[] Ob5; delete[] Ob6; delete[] Ob7;
-	for (int i = 0; i < 8; i++) {
+	for (int i = 0; i < node->numChildren(); i++) {
 		if ((node->child_[i]->num_ > maxLeaf_) && (depth != maxDepth_)) {  // If there is a significant number of particles in box and not at max depth
 			build(node->child_[i], depth);  // repeat process with child_ nodes
 		}
@@ -934,15 +1489,16 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 				node->child_[i]->Objs_ = nullptr;
 				continue;
 			}  // leaf case
+			node->child_[i]->leaf_ = true;
+			if (!Layout::centreOfData) { continue; }  // the coordinates are only needed again for the c.o.d.
 			vec3* V = new vec3[node->child_[i]->num_];  // get child_ c.o.d. coords
 			std::pair<vec3, double> result;
 			for (int j = 0; j < node->child_[i]->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
-				V[j] = func(node->child_[i]->Objs_[j]);
+				V[j] = getCoords(node->child_[i]->Objs_[j]);
 				node->child_[i]->x_ += V[j].x_;
 				node->child_[i]->y_ += V[j].y_;
 				node->child_[i]->z_ += V[j].z_;
 			}
-			node->child_[i]->leaf_ = true;
 			delete[] V;
 			if (node->child_[i]->num_ > 0) {  // set c.o.d.
 				node->child_[i]->setX(node->child_[i]->x_ / node->child_[i]->num_);
@@ -952,59 +1508,67 @@ void Octree<Tname>::build(Node<Tname>* node, int depth) {
 		}
 	}
 
-	if (node->num_ > maxLeaf_) {  // If there is a significant number of particles in box
-		if (depth != maxDepth_) {  // and depth is not child_ node depth (and hence definitely not a leaf node)
-			if (node->Objs_) { delete[] node->Objs_; }  // delete node objects, freeing up memory
-			node->Objs_ = nullptr;
-		}
+	if (node->hasChildren()) {  // children hold the objects now, including children at maxDepth
+		if (node->Objs_) { delete[] node->Objs_; }  // delete node objects, freeing up memory
+		node->Objs_ = nullptr;
 	}
 }
 
 // Octree update functions
-template <typename Tname>
+template <typename Tname, typename Instr, typename Layout>
 template <copyableOnly>
-Tname* Octree<Tname>::updateTree(Node<Tname>* node, Tname* lostObjs, int oldRootSize) {
+Tname* Octree<Tname, Instr, Layout>::updateTree(Node<Tname, Layout>* node, Tname* lostObjs, int oldRootSize) {
+	static_assert(Layout::parent, "updateTree() needs parent pointers, use parallelUpdateTree() with this node layout");
+	clearNodeTable();
 	// Iterate over nodes
 	if (oldRootSize == 0) { oldRootSize = root_->num_; }
 	int lostObjsSize = oldRootSize - root_->num_;
-	for (int i = 0; i < 8; i++) {
-		if (node->child_[i] && node->child_[i]->num_ > 0) {
-			if (node->child_[i]->leaf_) {	// child[i] is leaf node
+	for (int i = 0; i < 8; i++) {  // by octant, as moves can add and remove children
+		Node<Tname, Layout>* child = node->getChild(i);
+		if (child) { Instr::count(OctreeCounter::NodesVisited); }
+		if (child && child->num_ > 0) {
+			if (child->leaf_) {	// child[i] is leaf node
 				// For each object in a leaf node, check coordinates and find the new leaf node
-				int oldNum = node->child_[i]->num_; int newNum = oldNum;
+				int oldNum = child->num_; int newNum = oldNum;
 				bool* leftObjIndx = new bool[oldNum]();
-				for (int j = 0; j < node->child_[i]->num_; j++) {
+				for (int j = 0; j < child->num_; j++) {
 					leftObjIndx[j] = false;
-					vec3 coords = func(node->child_[i]->Objs_[j]);  // using function provided to get obj coords
-					Node<Tname>* destNode = findLeafNode(coords.x_, coords.y_, coords.z_);
+					vec3 coords = getCoords(child->Objs_[j]);  // using function provided to get obj coords
+					Node<Tname, Layout>* destNode = root_->contains(coords) ? makeLeaf(root_, coords) : nullptr;  // creates the leaf in an empty region
 					if (!destNode) {  // If object leaves octree, add to lostObjs
+						Instr::count(OctreeCounter::Lost);
+						Instr::count(OctreeCounter::Allocations);
+						countTransfers(lostObjsSize + 1);  // the lost array is regrown for every object
 						if (lostObjsSize != 0) {
 							lostObjsSize++;
 							Tname* newLostObjs = new Tname[lostObjsSize]();
 							for (int k = 0; k < lostObjsSize - 1; k++) {
 								newLostObjs[k] = lostObjs[k];
 							}
-							newLostObjs[lostObjsSize - 1] = node->child_[i]->Objs_[j];
+							newLostObjs[lostObjsSize - 1] = child->Objs_[j];
 							delete[] lostObjs;
 							lostObjs = newLostObjs;
 						}
 						else {
 							lostObjsSize++;
 							lostObjs = new Tname[1];
-							lostObjs[0] = node->child_[i]->Objs_[j];
+							lostObjs[0] = child->Objs_[j];
 						}
 						// Remove object from leaf node
 						leftObjIndx[j] = true;
 						newNum--;
 					}
-					else if (destNode != node->child_[i]) {  // If destination node!=origin node, move object to new node
+					else if (destNode != child) {  // If destination node!=origin node, move object to new node
+						Instr::count(OctreeCounter::Migrated);
+						Instr::count(OctreeCounter::Allocations);
+						countTransfers(destNode->num_ + 1);  // the destination array is regrown for every object
 						destNode->num_++;
 						Tname* destObjs = new Tname[destNode->num_]();
 						for (int k = 0; k < destNode->num_ - 1; k++) {
 							destObjs[k] = destNode->Objs_[k];
 						}
 						// Move object to leaf node, adjust array sizes appropriately
-						destObjs[destNode->num_ - 1] = node->child_[i]->Objs_[j];
+						destObjs[destNode->num_ - 1] = child->Objs_[j];
 						if (destNode->Objs_) {
 							delete[] destNode->Objs_;
 						}
@@ -1017,79 +1581,91 @@ Tname* Octree<Tname>::updateTree(Node<Tname>* node, Tname* lostObjs, int oldRoot
 				}
 				if (oldNum != newNum) {  // If object(s) have left child node
 					if (newNum == 0) {  // child node is empty
-						node->child_[i]->num_ = newNum;
-						updateNode(node->child_[i]);  // Update node and its parents
+						child->num_ = newNum;
+						updateNode(child);  // Update node and its parents
 					}
 					else {  // child node is still a leaf
+						Instr::count(OctreeCounter::Allocations);
+						countTransfers(newNum);
 						Tname* originObjs = new Tname[newNum];
 						int counter = 0;
 						for (int j = 0; j < oldNum; j++) {  // Remove objects that have left child node
 							if (leftObjIndx[j] == false) {
-								originObjs[counter] = node->child_[i]->Objs_[j];
+								originObjs[counter] = child->Objs_[j];
 								counter++;
 							}
 						}
-						node->child_[i]->num_ = newNum;
-						delete[] node->child_[i]->Objs_;
-						node->child_[i]->Objs_ = originObjs;
-						updateNode(node->child_[i]);  // Update child's parent nodes
+						child->num_ = newNum;
+						delete[] child->Objs_;
+						child->Objs_ = originObjs;
+						updateNode(child);  // Update child's parent nodes
 					}
 				}
 				lostObjsSize = oldRootSize - root_->num_;
 				delete[] leftObjIndx;
 			}
 			else {  // repeat for child's child nodes
-				lostObjs = updateTree(node->child_[i], lostObjs, oldRootSize);
+				lostObjs = updateTree(child, lostObjs, oldRootSize);
 			}
 		}
 	}
 	return lostObjs;
 }
 
-template <typename Tname>
+template <typename Tname, typename Instr, typename Layout>
 template <moveable>
-Tname* Octree<Tname>::updateTree(Node<Tname>* node, Tname* lostObjs, int oldRootSize) {
+Tname* Octree<Tname, Instr, Layout>::updateTree(Node<Tname, Layout>* node, Tname* lostObjs, int oldRootSize) {
+	static_assert(Layout::parent, "updateTree() needs parent pointers, use parallelUpdateTree() with this node layout");
+	clearNodeTable();
 	// Iterate over nodes
 	if (oldRootSize == 0) { oldRootSize = root_->num_; }
 	int lostObjsSize = oldRootSize - root_->num_;
-	for (int i = 0; i < 8; i++) {
-		if (node->child_[i] && node->child_[i]->num_ > 0) {
-			if (node->child_[i]->leaf_) {	// child[i] is leaf node
+	for (int i = 0; i < 8; i++) {  // by octant, as moves can add and remove children
+		Node<Tname, Layout>* child = node->getChild(i);
+		if (child) { Instr::count(OctreeCounter::NodesVisited); }
+		if (child && child->num_ > 0) {
+			if (child->leaf_) {	// child[i] is leaf node
 				// For each object in a leaf node, check coordinates and find the new leaf node
-				int oldNum = node->child_[i]->num_; int newNum = oldNum;
+				int oldNum = child->num_; int newNum = oldNum;
 				bool* leftObjIndx = new bool[oldNum]();
-				for (int j = 0; j < node->child_[i]->num_; j++) {
+				for (int j = 0; j < child->num_; j++) {
 					leftObjIndx[j] = false;
-					vec3 coords = func(node->child_[i]->Objs_[j]);  // using function provided to get obj coords
-					Node<Tname>* destNode = findLeafNode(coords.x_, coords.y_, coords.z_);
+					vec3 coords = getCoords(child->Objs_[j]);  // using function provided to get obj coords
+					Node<Tname, Layout>* destNode = root_->contains(coords) ? makeLeaf(root_, coords) : nullptr;  // creates the leaf in an empty region
 					if (!destNode) {  // If object leaves octree, add to lostObjs
+						Instr::count(OctreeCounter::Lost);
+						Instr::count(OctreeCounter::Allocations);
+						countTransfers(lostObjsSize + 1);  // the lost array is regrown for every object
 						if (lostObjsSize != 0) {
 							lostObjsSize++;
 							Tname* newLostObjs = new Tname[lostObjsSize];
 							for (int k = 0; k < lostObjsSize - 1; k++) {
 								newLostObjs[k] = std::move(lostObjs[k]);
 							}
-							newLostObjs[lostObjsSize - 1] = std::move(node->child_[i]->Objs_[j]);
+							newLostObjs[lostObjsSize - 1] = std::move(child->Objs_[j]);
 							delete[] lostObjs;
 							lostObjs = newLostObjs;
 						}
 						else {
 							lostObjsSize++;
 							lostObjs = new Tname[1];
-							lostObjs[0] = std::move(node->child_[i]->Objs_[j]);
+							lostObjs[0] = std::move(child->Objs_[j]);
 						}
 						// Remove object from leaf node
 						leftObjIndx[j] = true;
 						newNum--;
 					}
-					else if (destNode != node->child_[i]) {  // If destination node!=origin node, move object to new node
+					else if (destNode != child) {  // If destination node!=origin node, move object to new node
+						Instr::count(OctreeCounter::Migrated);
+						Instr::count(OctreeCounter::Allocations);
+						countTransfers(destNode->num_ + 1);  // the destination array is regrown for every object
 						destNode->num_++;
 						Tname* destObjs = new Tname[destNode->num_];
 						for (int k = 0; k < destNode->num_ - 1; k++) {
 							destObjs[k] = std::move(destNode->Objs_[k]);
 						}
 						// Move object to leaf node, adjust array sizes appropriately
-						destObjs[destNode->num_ - 1] = std::move(node->child_[i]->Objs_[j]);
+						destObjs[destNode->num_ - 1] = std::move(child->Objs_[j]);
 						if (destNode->Objs_) {
 							delete[] destNode->Objs_;
 						}
@@ -1102,43 +1678,49 @@ Tname* Octree<Tname>::updateTree(Node<Tname>* node, Tname* lostObjs, int oldRoot
 				}
 				if (oldNum != newNum) {  // If object(s) have left child node
 					if (newNum == 0) {  // child node is empty
-						node->child_[i]->num_ = newNum;
-						updateNode(node->child_[i]);  // Update node and its parents
+						child->num_ = newNum;
+						updateNode(child);  // Update node and its parents
 					}
 					else {  // child node is still a leaf
+						Instr::count(OctreeCounter::Allocations);
+						countTransfers(newNum);
 						Tname* originObjs = new Tname[newNum];
 						int counter = 0;
 						for (int j = 0; j < oldNum; j++) {  // Remove objects that have left child node
 							if (leftObjIndx[j] == false) {
-								originObjs[counter] = std::move(node->child_[i]->Objs_[j]);
+								originObjs[counter] = std::move(child->Objs_[j]);
 								counter++;
 							}
 						}
-						node->child_[i]->num_ = newNum;
-						delete[] node->child_[i]->Objs_;
-						node->child_[i]->Objs_ = originObjs;
-						updateNode(node->child_[i]);  // Update child's parent nodes
+						child->num_ = newNum;
+						delete[] child->Objs_;
+						child->Objs_ = originObjs;
+						updateNode(child);  // Update child's parent nodes
 					}
 				}
 				lostObjsSize = oldRootSize - root_->num_;
 				delete[] leftObjIndx;
 			}
 			else {  // repeat for child's child nodes
-				lostObjs = updateTree(node->child_[i], lostObjs, oldRootSize);
+				lostObjs = updateTree(child, lostObjs, oldRootSize);
 			}
 		}
 	}
 	return lostObjs;
 }
 
-template <typename Tname>
+template <typename Tname, typename Instr, typename Layout>
 template <copyableOnly>
-void Octree<Tname>::updateNode(Node<Tname>* node) {
+void Octree<Tname, Instr, Layout>::updateNode(Node<Tname, Layout>* node) {
+	static_assert(Layout::parent, "updateNode() needs parent pointers");
+	clearNodeTable();
 	// Updates node statistics with information from object list
+	Instr::count(OctreeCounter::NodesVisited);
 	if (node->leaf_) {  // If node was previously a leaf node
 						// Node has gained enough particles and is no longer a leaf
 						// Node has different number of particles and is either still a leaf or empty
 		if ((node->num_ > maxLeaf_) && (node->depth_ != maxDepth_)) {  // If node is no longer a leaf node
+			Instr::count(OctreeCounter::Splits);
 			node->leaf_ = false;  // node was previously a leaf node
 			build(node, node->depth_);  // build child nodes from node
 		}
@@ -1147,12 +1729,18 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 				node->x_ = 0; node->y_ = 0; node->z_ = 0;
 				delete[] node->Objs_; node->Objs_ = nullptr;
 				node->leaf_ = false;  // node was previously a leaf node
+				Node<Tname, Layout>* parent = node->parent_;
+				if (parent) {  // free the node, leaving its octant absent
+					parent->removeChild(parent->getChildOctant(node));
+					updateNode(parent);
+					return;
+				}
 			}
-			else {  // leaf case
+			else if (Layout::centreOfData) {  // leaf case, recompute c.o.d.
 				vec3* V = new vec3[node->num_];  // get c.o.d. coords
 				node->x_ = 0; node->y_ = 0; node->z_ = 0;
 				for (int j = 0; j < node->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
-					V[j] = func(node->Objs_[j]);
+					V[j] = getCoords(node->Objs_[j]);
 					node->x_ += V[j].x_;
 					node->y_ += V[j].y_;
 					node->z_ += V[j].z_;
@@ -1170,10 +1758,8 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 								// Node's children have updated and node needs updating
 		int oldNum = node->num_;
 		int newNum = 0;  // Calculate new node->num_
-		for (int i = 0; i < 8; i++) {
-			if (node->child_[i]) {
-				newNum += node->child_[i]->num_;
-			}
+		for (int i = 0; i < node->numChildren(); i++) {
+			newNum += node->child_[i]->num_;
 		}
 		if (oldNum == newNum) {  // The node and its children are all updated
 			return;
@@ -1181,7 +1767,7 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 		// Node needs updating
 		node->num_ = newNum;
 		if ((node->num_ > maxLeaf_) && (node->depth_ != maxDepth_)) {  // If node is a parent node
-			for (int i = 0; i < 8; i++) {  // Calculate c.o.d. of Node by iterating over new children statistics
+			for (int i = 0; i < node->numChildren(); i++) {  // Calculate c.o.d. of Node by iterating over new children statistics
 				node->x_ += (node->child_[i]->x_ * node->child_[i]->num_);
 				node->y_ += (node->child_[i]->y_ * node->child_[i]->num_);
 				node->z_ += (node->child_[i]->z_ * node->child_[i]->num_);
@@ -1189,41 +1775,41 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 			node->setX(node->x_ / node->num_); node->setY(node->y_ / node->num_); node->setZ(node->z_ / node->num_);
 		}
 		else {  // If node has changed to a leaf node or an empty node
+			Instr::count(OctreeCounter::Collapses);
 			if (node->num_ == 0) {  // empty case
 				node->x_ = 0; node->y_ = 0; node->z_ = 0;
 				node->Objs_ = nullptr;
-				for (int i = 0; i < 8; i++) {
-					delete node->child_[i];
-					node->child_[i] = nullptr;
-				}
+				node->clearChildren();
 			}
 			else {  // leaf case
+				Instr::count(OctreeCounter::Allocations);
+				countTransfers(node->num_);
 				Tname* objs = new Tname[node->num_];
 				int counter = 0;
-				for (int i = 0; i < 8; i++) {  // Iterate over nodes, passing objects to parent node
+				for (int i = 0; i < node->numChildren(); i++) {  // Iterate over nodes, passing objects to parent node
 					for (int j = 0; j < node->child_[i]->num_; j++) {
 						objs[counter] = node->child_[i]->Objs_[j];
 						counter++;
 					}
-					delete node->child_[i];
-					node->child_[i] = nullptr;
 				}
+				node->clearChildren();
 				node->Objs_ = objs;
-				vec3* V = new vec3[node->num_];  // get c.o.d. coords
-				std::pair<vec3, double> result;
-				node->x_ = 0; node->y_ = 0; node->z_ = 0;
-				for (int j = 0; j < node->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
-					V[j] = func(node->Objs_[j]);
-					node->x_ += V[j].x_;
-					node->y_ += V[j].y_;
-					node->z_ += V[j].z_;
-				}
 				node->leaf_ = true;  // Node is now a leaf node
-				delete[] V;
-				// set c.o.d.
-				node->setX(node->x_ / node->num_);
-				node->setY(node->y_ / node->num_);
-				node->setZ(node->z_ / node->num_);
+				if (Layout::centreOfData) {
+					vec3* V = new vec3[node->num_];  // get c.o.d. coords
+					node->x_ = 0; node->y_ = 0; node->z_ = 0;
+					for (int j = 0; j < node->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
+						V[j] = getCoords(node->Objs_[j]);
+						node->x_ += V[j].x_;
+						node->y_ += V[j].y_;
+						node->z_ += V[j].z_;
+					}
+					delete[] V;
+					// set c.o.d.
+					node->setX(node->x_ / node->num_);
+					node->setY(node->y_ / node->num_);
+					node->setZ(node->z_ / node->num_);
+				}
 			}
 		}
 	}
@@ -1233,14 +1819,18 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 	return;
 }
 
-template <typename Tname>
+template <typename Tname, typename Instr, typename Layout>
 template <moveable>
-void Octree<Tname>::updateNode(Node<Tname>* node) {
+void Octree<Tname, Instr, Layout>::updateNode(Node<Tname, Layout>* node) {
+	static_assert(Layout::parent, "updateNode() needs parent pointers");
+	clearNodeTable();
 	// Updates node statistics with information from object list
+	Instr::count(OctreeCounter::NodesVisited);
 	if (node->leaf_) {  // If node was previously a leaf node
 						// Node has gained enough particles and is no longer a leaf
 						// Node has different number of particles and is either still a leaf or empty
 		if ((node->num_ > maxLeaf_) && (node->depth_ != maxDepth_)) {  // If node is no longer a leaf node
+			Instr::count(OctreeCounter::Splits);
 			node->leaf_ = false;  // node was previously a leaf node
 			build(node, node->depth_);  // build child nodes from node
 		}
@@ -1249,12 +1839,18 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 				node->x_ = 0; node->y_ = 0; node->z_ = 0;
 				delete[] node->Objs_; node->Objs_ = nullptr;
 				node->leaf_ = false;  // node was previously a leaf node
+				Node<Tname, Layout>* parent = node->parent_;
+				if (parent) {  // free the node, leaving its octant absent
+					parent->removeChild(parent->getChildOctant(node));
+					updateNode(parent);
+					return;
+				}
 			}
-			else {  // leaf case
+			else if (Layout::centreOfData) {  // leaf case, recompute c.o.d.
 				vec3* V = new vec3[node->num_];  // get c.o.d. coords
 				node->x_ = 0; node->y_ = 0; node->z_ = 0;
 				for (int j = 0; j < node->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
-					V[j] = func(node->Objs_[j]);
+					V[j] = getCoords(node->Objs_[j]);
 					node->x_ += V[j].x_;
 					node->y_ += V[j].y_;
 					node->z_ += V[j].z_;
@@ -1272,10 +1868,8 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 								// Node's children have updated and node needs updating
 		int oldNum = node->num_;
 		int newNum = 0;  // Calculate new node->num_
-		for (int i = 0; i < 8; i++) {
-			if (node->child_[i]) {
-				newNum += node->child_[i]->num_;
-			}
+		for (int i = 0; i < node->numChildren(); i++) {
+			newNum += node->child_[i]->num_;
 		}
 		if (oldNum == newNum) {  // The node and its children are all updated
 			return;
@@ -1283,7 +1877,7 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 		// Node needs updating
 		node->num_ = newNum;
 		if ((node->num_ > maxLeaf_) && (node->depth_ != maxDepth_)) {  // If node is a parent node
-			for (int i = 0; i < 8; i++) {  // Calculate c.o.d. of Node by iterating over new children statistics
+			for (int i = 0; i < node->numChildren(); i++) {  // Calculate c.o.d. of Node by iterating over new children statistics
 				node->x_ += (node->child_[i]->x_ * node->child_[i]->num_);
 				node->y_ += (node->child_[i]->y_ * node->child_[i]->num_);
 				node->z_ += (node->child_[i]->z_ * node->child_[i]->num_);
@@ -1291,41 +1885,41 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 			node->setX(node->x_ / node->num_); node->setY(node->y_ / node->num_); node->setZ(node->z_ / node->num_);
 		}
 		else {  // If node has changed to a leaf node or an empty node
+			Instr::count(OctreeCounter::Collapses);
 			if (node->num_ == 0) {  // empty case
 				node->x_ = 0; node->y_ = 0; node->z_ = 0;
 				node->Objs_ = nullptr;
-				for (int i = 0; i < 8; i++) {
-					delete node->child_[i];
-					node->child_[i] = nullptr;
-				}
+				node->clearChildren();
 			}
 			else {  // leaf case
+				Instr::count(OctreeCounter::Allocations);
+				countTransfers(node->num_);
 				Tname* objs = new Tname[node->num_];
 				int counter = 0;
-				for (int i = 0; i < 8; i++) {  // Iterate over nodes, passing objects to parent node
+				for (int i = 0; i < node->numChildren(); i++) {  // Iterate over nodes, passing objects to parent node
 					for (int j = 0; j < node->child_[i]->num_; j++) {
 						objs[counter] = std::move(node->child_[i]->Objs_[j]);
 						counter++;
 					}
-					delete node->child_[i];
-					node->child_[i] = nullptr;
 				}
+				node->clearChildren();
 				node->Objs_ = objs;
-				vec3* V = new vec3[node->num_];  // get c.o.d. coords
-				std::pair<vec3, double> result;
-				node->x_ = 0; node->y_ = 0; node->z_ = 0;
-				for (int j = 0; j < node->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
-					V[j] = func(node->Objs_[j]);
-					node->x_ += V[j].x_;
-					node->y_ += V[j].y_;
-					node->z_ += V[j].z_;
-				}
 				node->leaf_ = true;  // Node is now a leaf node
-				delete[] V;
-				// set c.o.d.
-				node->setX(node->x_ / node->num_);
-				node->setY(node->y_ / node->num_);
-				node->setZ(node->z_ / node->num_);
+				if (Layout::centreOfData) {
+					vec3* V = new vec3[node->num_];  // get c.o.d. coords
+					node->x_ = 0; node->y_ = 0; node->z_ = 0;
+					for (int j = 0; j < node->num_; j++) {  // Calculate c.o.d. of node by producing array of vec3=length of object array
+						V[j] = getCoords(node->Objs_[j]);
+						node->x_ += V[j].x_;
+						node->y_ += V[j].y_;
+						node->z_ += V[j].z_;
+					}
+					delete[] V;
+					// set c.o.d.
+					node->setX(node->x_ / node->num_);
+					node->setY(node->y_ / node->num_);
+					node->setZ(node->z_ / node->num_);
+				}
 			}
 		}
 	}
@@ -1335,180 +1929,2553 @@ void Octree<Tname>::updateNode(Node<Tname>* node) {
 	return;
 }
 
-// Octree move/copy octree object functions
-template <typename Tname>
-template <moveable>
-Tname* Octree<Tname>::moveTreeData(Node<Tname>* node, Tname* ObjArr, bool homeNode) {
-	static int counter;
-	if (homeNode) {
-		homeNode = false;
-		counter = 0;  // initialise array element counter
-		int size = node->num_;
-		if (ObjArr == nullptr) { ObjArr = new Tname[size](); }  // Create new array of size of Octree
-		if (!!node->child_[0] + !!node->child_[1] + !!node->child_[2] + !!node->child_[3] +
-			!!node->child_[4] + !!node->child_[5] + !!node->child_[6] + !!node->child_[7] == 0) {  // If no child nodes beyond homeNode
-			for (int j = 0; j < node->num_; j++) {
-				ObjArr[counter] = std::move(node->Objs_[j]);  // Move element to array
-				counter++;  // increase iterator
-			}
-			node->num_ = 0;  // No objects in node->child_[i] now
-			updateNode(node);  // Update node->child_[i] and its parent nodes
-			return ObjArr;
-		}
+// Octree parallel update functions
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::descendToLeaf(Node<Tname, Layout>* node, const vec3& V) const {
+	while (node->hasChildren()) {  // while not at a leaf or empty node
+		Instr::count(OctreeCounter::NodesVisited);
+		Node<Tname, Layout>* child = node->getChild(node->getOctant(V));
+		if (!child) { break; }  // absent child_, node is the deepest node on the path
+		node = child;
 	}
-	for (int i = 0; i < 8; i++) {  // Iterating over the child_ nodes
-		if ((node->child_[i]->num_ > maxLeaf_) && (node->child_[i]->depth_ != maxDepth_)) {
-			ObjArr = moveTreeData(node->child_[i], ObjArr, homeNode);  // repeat process with child_ nodes
-																	  // returns array of children's particles
-		}
-		else {
-			if (node->child_[i]->Objs_ != nullptr) {
-				for (int j = 0; j < node->child_[i]->num_; j++) {
-					ObjArr[counter] = std::move(node->child_[i]->Objs_[j]);  // Move element to array
-					counter++;  // increase iterator
-				}
-				node->child_[i]->num_ = 0;  // No objects in node->child_[i] now
-				updateNode(node->child_[i]);  // Update node->child_[i] and its parent nodes
-			}
-		}
+	return node;
+}
+
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::makeChild(Node<Tname, Layout>* node, int octant) {
+	vec3 split = node->getSplit();
+	double xCent = split.x_, yCent = split.y_, zCent = split.z_;
+	Instr::count(OctreeCounter::Allocations);
+	Node<Tname, Layout>* child = new Node<Tname, Layout>();
+	child->xMax_ = (octant & 2) ? node->xMax_ : xCent; child->xMin_ = (octant & 2) ? xCent : node->xMin_;
+	child->yMax_ = (octant & 1) ? node->yMax_ : yCent; child->yMin_ = (octant & 1) ? yCent : node->yMin_;
+	child->zMax_ = (octant & 4) ? node->zMax_ : zCent; child->zMin_ = (octant & 4) ? zCent : node->zMin_;
+	child->depth_ = node->depth_ + 1;
+	child->leaf_ = true;  // the caller fills it straight away
+	child->parent_ = node;
+	node->addChild(octant, child);
+	return child;
+}
+
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::makeLeaf(Node<Tname, Layout>* node, const vec3& V) {
+	node = descendToLeaf(node, V);
+	if (node->hasChildren()) {  // the octant holding V is absent
+		return makeChild(node, node->getOctant(V));
 	}
-	return ObjArr;  // return array of objects
+	if (node->num_ == 0) { node->leaf_ = true; }  // an empty node becomes a leaf once filled
+	return node;
 }
 
-template <typename Tname>
-template <copyable>
-Tname* Octree<Tname>::copyTreeData(Node<Tname>* node, Tname* ObjArr, bool homeNode) const {
-	static int counter;
-	if (homeNode) {
-		homeNode = false;
-		counter = 0;  // initialise array element counter
-		int size = node->num_;
-		if (ObjArr == nullptr) { ObjArr = new Tname[size](); }  // Create new array of size of node->num_
-		if (!!node->child_[0] + !!node->child_[1] + !!node->child_[2] + !!node->child_[3] +
-			!!node->child_[4] + !!node->child_[5] + !!node->child_[6] + !!node->child_[7] == 0) {  // If no child nodes beyond homeNode
-			for (int j = 0; j < node->num_; j++) {
-				ObjArr[counter] = node->Objs_[j];  // Move element to array
-				counter++;  // increase iterator
-			}
-			return ObjArr;
-		}
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::insertMovedObjs(Node<Tname, Layout>* node, std::vector<MovedObj>& inbox) {
+	// Group incoming objects by destination leaf so each leaf is reallocated once
+	int size = (int)inbox.size();
+	std::vector<std::pair<Node<Tname, Layout>*, int>> dests(size);
+	for (int i = 0; i < size; i++) {
+		dests[i] = { makeLeaf(node, inbox[i].coords), i };
 	}
-	for (int i = 0; i < 8; i++) {  // Iterating over the child_ nodes
-		if ((node->child_[i]->num_ > maxLeaf_) && (node->child_[i]->depth_ != maxDepth_)) {
-			ObjArr = copyTreeData(node->child_[i], ObjArr, homeNode);  // repeat process with child_ nodes
-																	  // returns array of children's particles
+	std::sort(dests.begin(), dests.end(), [](const std::pair<Node<Tname, Layout>*, int>& a, const std::pair<Node<Tname, Layout>*, int>& b) { return a.first < b.first; });
+	for (int start = 0; start < size;) {
+		Node<Tname, Layout>* destNode = dests[start].first;
+		int end = start;
+		while (end < size && dests[end].first == destNode) { end++; }
+		Instr::count(OctreeCounter::Allocations);
+		Tname* destObjs = new Tname[destNode->num_ + end - start];
+		for (int k = 0; k < destNode->num_; k++) {
+			transfer(destObjs[k], destNode->Objs_[k]);
 		}
-		else {
-			if (node->child_[i]->Objs_ != nullptr) {
-				for (int j = 0; j < node->child_[i]->num_; j++) {
-					ObjArr[counter] = node->child_[i]->Objs_[j];  // Copy over element to array
-					counter++;  // increase iterator
-				}
-			}
+		for (int k = start; k < end; k++) {  // append objects, adding to the leaf's coordinate sums
+			MovedObj& moved = inbox[dests[k].second];
+			transfer(destObjs[destNode->num_ + k - start], moved.obj);
+			destNode->x_ += moved.coords.x_; destNode->y_ += moved.coords.y_; destNode->z_ += moved.coords.z_;
 		}
+		if (destNode->Objs_) { delete[] destNode->Objs_; }
+		destNode->Objs_ = destObjs;
+		destNode->num_ += end - start;
+		destNode->leaf_ = true;
+		start = end;
 	}
-	return ObjArr;  // return array of objects
+	inbox.clear();
 }
 
-// Octree add to octree functions
-template <typename Tname>
-template<copyableOnly>
-void Octree<Tname>::addToTree(Tname Obj) {
-	vec3 coords = func(Obj);  // using function provided to get obj coords
-	Node<Tname>* destNode = findLeafNode(coords.x_, coords.y_, coords.z_);
-	if (!destNode) {  // object is out of bounds. Call addToTree(Tname*).
-		Tname* ObjArr = new Tname[1]; ObjArr[0] = std::move(Obj);
-		addToTree(ObjArr, 1);  // rebuild tree
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::combineChildren(Node<Tname, Layout>* node) {
+	// Children are finished, so their c.o.d. values are averages
+	int newNum = 0;
+	double x = 0, y = 0, z = 0;
+	for (int i = 0; i < node->numChildren(); i++) {
+		newNum += node->child_[i]->num_;
+		x += node->child_[i]->x_ * node->child_[i]->num_;
+		y += node->child_[i]->y_ * node->child_[i]->num_;
+		z += node->child_[i]->z_ * node->child_[i]->num_;
 	}
-	else {  // object is in bounds. Update destination node and parents
-		Tname* destObjs = new Tname[destNode->num_ + 1];
-		for (int k = 0; k < destNode->num_; k++) {
-			destObjs[k] = destNode->Objs_[k];
+	node->num_ = newNum;
+	if (newNum > maxLeaf_) {  // still a parent node, free children that emptied
+		for (int i = 7; i >= 0; i--) {
+			if (node->getChild(i) && node->getChild(i)->num_ == 0) { node->removeChild(i); }
 		}
-		// Move object to leaf node, adjust array sizes appropriately
-		destObjs[destNode->num_] = Obj;
-		destNode->num_++;
-		if (destNode->Objs_ != nullptr) {
-			delete[] destNode->Objs_;
+		node->setX(x / newNum); node->setY(y / newNum); node->setZ(z / newNum);
+		return;
+	}
+	Instr::count(OctreeCounter::Collapses);
+	Instr::count(OctreeCounter::Allocations, newNum > 0);
+	Tname* objs = (newNum > 0) ? new Tname[newNum] : nullptr;  // collapse into a leaf or empty node
+	int counter = 0;
+	for (int i = 0; i < node->numChildren(); i++) {  // children are leaves or empty nodes after their refresh
+		for (int j = 0; j < node->child_[i]->num_; j++) {
+			transfer(objs[counter], node->child_[i]->Objs_[j]);
+			counter++;
 		}
-		destNode->Objs_ = destObjs;
-		updateNode(destNode);  // Update destination node, building more leaves if needed, update extended family nodes
 	}
-	return;
+	node->clearChildren();
+	if (node->Objs_) { delete[] node->Objs_; }
+	node->Objs_ = objs;
+	node->leaf_ = newNum > 0;
+	if (newNum > 0) {
+		node->setX(x / newNum); node->setY(y / newNum); node->setZ(z / newNum);
+	}
+	else {
+		node->x_ = 0; node->y_ = 0; node->z_ = 0;
+	}
 }
 
-template <typename Tname>
-template<moveable>
-void Octree<Tname>::addToTree(Tname Obj) {
-	vec3 coords = func(Obj);  // using function provided to get obj coords
-	Node<Tname>* destNode = findLeafNode(coords.x_, coords.y_, coords.z_);
-	if (!destNode) {  // object is out of bounds. Call addToTree(Tname*).
-		Tname* ObjArr = new Tname[1]; ObjArr[0] = std::move(Obj);
-		addToTree(ObjArr, 1);  // rebuild tree
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::refreshNode(Node<Tname, Layout>* node) {
+	// Leaves hold coordinate sums in x_, y_, z_ on entry
+	if (node->hasChildren()) {
+		for (int i = 0; i < node->numChildren(); i++) {
+			refreshNode(node->child_[i]);
+		}
+		combineChildren(node);
 	}
-	else {  // object is in bounds. Update destination node and parents
-		Tname* destObjs = new Tname[destNode->num_ + 1];
-		for (int k = 0; k < destNode->num_; k++) {
-			destObjs[k] = std::move(destNode->Objs_[k]);
+	else if (node->num_ == 0) {  // empty case
+		if (node->Objs_) { delete[] node->Objs_; }
+		node->Objs_ = nullptr;
+		node->leaf_ = false;
+		node->x_ = 0; node->y_ = 0; node->z_ = 0;
+	}
+	else if ((node->num_ > maxLeaf_) && (node->depth_ != maxDepth_)) {  // overfull leaf, split once
+		Instr::count(OctreeCounter::Splits);
+		node->x_ = 0; node->y_ = 0; node->z_ = 0;
+		node->leaf_ = false;
+		build(node, node->depth_);
+	}
+	else {  // leaf case, set c.o.d.
+		node->leaf_ = true;
+		node->setX(node->x_ / node->num_); node->setY(node->y_ / node->num_); node->setZ(node->z_ / node->num_);
+	}
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::refreshAncestors(Node<Tname, Layout>* node, int frontierDepth) {
+	if (node->depth_ == frontierDepth || !node->hasChildren()) { return; }  // subtree already refreshed by a worker
+	for (int i = 0; i < node->numChildren(); i++) {
+		refreshAncestors(node->child_[i], frontierDepth);
+	}
+	combineChildren(node);
+}
+
+template <typename Tname, typename Instr, typename Layout> int Octree<Tname, Instr, Layout>::getFrontier(int numThreads, std::vector<Node<Tname, Layout>*>& tasks) const {
+	if (numThreads <= 0) { numThreads = std::max(1, (int)std::thread::hardware_concurrency()); }
+	// Pick a frontier depth giving enough disjoint subtrees to share between workers
+	int frontierDepth = root_->depth_;
+	std::vector<Node<Tname, Layout>*> level{ root_ };
+	while ((int)level.size() < 4 * numThreads) {
+		std::vector<Node<Tname, Layout>*> nextLevel;
+		bool expanded = false;
+		for (Node<Tname, Layout>* node : level) {
+			if (node->hasChildren()) {
+				expanded = true;
+				for (int i = 0; i < node->numChildren(); i++) { nextLevel.push_back(node->child_[i]); }
+			}
 		}
-		// Move object to leaf node, adjust array sizes appropriately
-		destObjs[destNode->num_] = std::move(Obj);
-		destNode->num_++;
-		if (destNode->Objs_ != nullptr) {
-			delete[] destNode->Objs_;
+		if (!expanded) { break; }
+		frontierDepth++;
+		level = std::move(nextLevel);
+	}
+	// Tasks are the frontier nodes plus any leaves/empty nodes above the frontier
+	tasks.clear();
+	std::vector<Node<Tname, Layout>*> stack{ root_ };
+	while (!stack.empty()) {
+		Node<Tname, Layout>* node = stack.back(); stack.pop_back();
+		if (node->depth_ == frontierDepth || !node->hasChildren()) {
+			tasks.push_back(node);
+		}
+		else {
+			for (int i = 0; i < node->numChildren(); i++) { stack.push_back(node->child_[i]); }
 		}
-		destNode->Objs_ = destObjs;
-		updateNode(destNode);  // Update destination node, building more leaves if needed, update extended family nodes
 	}
-	return;
+	return frontierDepth;
 }
 
-template <typename Tname>
-template<copyableOnly>
-void Octree<Tname>::addToTree(Tname* ObjArr, int size) {
-	int treeTot = root_->num_ + size;
-	Tname* Objects = copyTreeData(root_);  // get data
-	root_->num_ = treeTot;  // add to root size
-	Tname* allObjects = new Tname[treeTot];
-	for (int j = 0; j < root_->num_ - size; j++) {
-		allObjects[j] = Objects[j];
+template <typename Tname, typename Instr, typename Layout> Tname* Octree<Tname, Instr, Layout>::parallelUpdateTree(int numThreads) {
+	clearNodeTable();
+	std::vector<Node<Tname, Layout>*> tasks;
+	int frontierDepth = getFrontier(numThreads, tasks);
+	int numTasks = (int)tasks.size();
+	std::unordered_map<Node<Tname, Layout>*, int> taskIndx;
+	for (int t = 0; t < numTasks; t++) { taskIndx[tasks[t]] = t; }
+
+	// Phase 1: per-subtree workers keep objects still inside their leaf and collect the rest
+	std::vector<std::vector<MovedObj>> moved(numTasks);
+	std::vector<std::vector<std::pair<Node<Tname, Layout>*, Tname*>>> trimmed(numTasks);
+	parallelFor(numTasks, numThreads, [&](int t) {
+		std::vector<Node<Tname, Layout>*> nodes{ tasks[t] };
+		while (!nodes.empty()) {
+			Node<Tname, Layout>* node = nodes.back(); nodes.pop_back();
+			Instr::count(OctreeCounter::NodesVisited);
+			if (node->hasChildren()) {
+				for (int i = 0; i < node->numChildren(); i++) { nodes.push_back(node->child_[i]); }
+				continue;
+			}
+			int keep = 0;
+			node->x_ = 0; node->y_ = 0; node->z_ = 0;  // leaf c.o.d. becomes a coordinate sum
+			for (int j = 0; j < node->num_; j++) {
+				vec3 coords = getCoords(node->Objs_[j]);  // using function provided to get obj coords
+				if (owns(node, coords)) {  // object stays
+					if (keep != j) { transfer(node->Objs_[keep], node->Objs_[j]); }
+					node->x_ += coords.x_; node->y_ += coords.y_; node->z_ += coords.z_;
+					keep++;
+				}
+				else {  // object leaves its leaf
+					moved[t].emplace_back();
+					transfer(moved[t].back().obj, node->Objs_[j]);
+					moved[t].back().coords = coords;
+				}
+			}
+			if (keep != node->num_) {
+				node->num_ = keep;
+				trimmed[t].push_back({ node, node->Objs_ });
+			}
+		}
+	});
+
+	// Merge pass: route objects that escaped their subtree to the owning subtree, or the lost array
+	std::vector<std::vector<MovedObj>> inbox(numTasks);
+	std::vector<MovedObj> lost;
+	for (int t = 0; t < numTasks; t++) {
+		for (MovedObj& obj : moved[t]) {
+			std::vector<MovedObj>* dest = &inbox[t];
+			if (!owns(tasks[t], obj.coords)) {
+				if (!root_->contains(obj.coords)) {
+					dest = &lost;
+				}
+				else {  // descend to the frontier
+					Node<Tname, Layout>* node = root_;
+					while (node->depth_ != frontierDepth && node->hasChildren()) {
+						int octant = node->getOctant(obj.coords);
+						if (!node->getChild(octant)) {  // empty region above the frontier, its new leaf is a task of its own
+							Node<Tname, Layout>* child = makeChild(node, octant);
+							taskIndx[child] = (int)tasks.size();
+							tasks.push_back(child);
+							inbox.emplace_back();
+							trimmed.emplace_back();
+						}
+						node = node->getChild(octant);
+					}
+					dest = &inbox[taskIndx[node]];
+				}
+			}
+			Instr::count((dest == &lost) ? OctreeCounter::Lost : OctreeCounter::Migrated);
+			dest->emplace_back();
+			transfer(dest->back().obj, obj.obj);
+			dest->back().coords = obj.coords;
+		}
+		moved[t].clear();
 	}
-	for (int j = 0; j < size; j++) {
-		allObjects[root_->num_ - size + j] = ObjArr[j];  // copy over array of objects
+	numTasks = (int)tasks.size();
+
+	// Phase 2: per-subtree workers insert arrivals and recompute their subtree bottom-up once
+	parallelFor(numTasks, numThreads, [&](int t) {
+		insertMovedObjs(tasks[t], inbox[t]);
+		for (std::pair<Node<Tname, Layout>*, Tname*>& leaf : trimmed[t]) {  // shrink leaves that only lost objects
+			Node<Tname, Layout>* node = leaf.first;
+			if (node->Objs_ != leaf.second) { continue; }
+			Instr::count(OctreeCounter::Allocations, node->num_ > 0);
+			Tname* objs = (node->num_ > 0) ? new Tname[node->num_] : nullptr;
+			for (int j = 0; j < node->num_; j++) {
+				transfer(objs[j], node->Objs_[j]);
+			}
+			delete[] node->Objs_;
+			node->Objs_ = objs;
+		}
+		refreshNode(tasks[t]);
+	});
+
+	// Ancestors above the frontier are recomputed serially, after all subtrees are done
+	refreshAncestors(root_, frontierDepth);
+	if (lost.empty()) { return nullptr; }
+	Tname* lostObjs = new Tname[lost.size()];
+	for (int i = 0; i < (int)lost.size(); i++) {
+		transfer(lostObjs[i], lost[i].obj);
+	}
+	return lostObjs;
+}
+
+// Octree refit functions
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::refitNode(Node<Tname, Layout>* node, RefitQuality& quality) {
+	Instr::count(OctreeCounter::NodesVisited);
+	if (node->hasChildren()) {
+		for (int i = 0; i < node->numChildren(); i++) {
+			refitNode(node->child_[i], quality);
+		}
+		combineRefit(node);
+		return;
+	}
+	node->x_ = 0; node->y_ = 0; node->z_ = 0;
+	for (int j = 0; j < node->num_; j++) {  // leaf or empty node, recompute c.o.d. and content bounds from objects
+		box3 B = getBox(node->Objs_[j]);  // a point box unless objects have extent, making the content bounds loose
+		vec3 V = B.centre();
+		if constexpr (Layout::contentBounds) {
+			if (j == 0) { node->contMin_ = B.min_; node->contMax_ = B.max_; }
+			node->contMin_ = vec3{ std::min(node->contMin_.x_, B.min_.x_), std::min(node->contMin_.y_, B.min_.y_), std::min(node->contMin_.z_, B.min_.z_) };
+			node->contMax_ = vec3{ std::max(node->contMax_.x_, B.max_.x_), std::max(node->contMax_.y_, B.max_.y_), std::max(node->contMax_.z_, B.max_.z_) };
+		}
+		node->x_ += V.x_; node->y_ += V.y_; node->z_ += V.z_;
+		if (!node->contains(V)) { quality.misplaced_++; }
+	}
+	if (node->num_ > 0) {
+		node->setX(node->x_ / node->num_); node->setY(node->y_ / node->num_); node->setZ(node->z_ / node->num_);
+	}
+	if constexpr (Layout::contentBounds) {  // the overhang is measured from the content bounds
+		if (node->num_ > 0) {
+			// Largest overhang of the contents past the cell, relative to the cell size
+			double overhang = std::max({ (node->xMin_ - node->contMin_.x_) / node->getXLength(), (node->contMax_.x_ - node->xMax_) / node->getXLength(),
+				(node->yMin_ - node->contMin_.y_) / node->getYLength(), (node->contMax_.y_ - node->yMax_) / node->getYLength() });
+			if (Layout::dims == 3) {
+				overhang = std::max({ overhang, (node->zMin_ - node->contMin_.z_) / node->getZLength(), (node->contMax_.z_ - node->zMax_) / node->getZLength() });
+			}
+			quality.maxOverhang_ = std::max(quality.maxOverhang_, overhang);
+		}
+		else {
+			node->contMin_ = node->contMax_ = vec3{ 0, 0, 0 };
+		}
+	}
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::combineRefit(Node<Tname, Layout>* node) {
+	// Membership is unchanged, so num_ is kept and only c.o.d. and content bounds are recomputed
+	double x = 0, y = 0, z = 0;
+	bool first = true;
+	for (int i = 0; i < node->numChildren(); i++) {
+		Node<Tname, Layout>* child = node->child_[i];
+		if (child->num_ == 0) { continue; }
+		x += child->x_ * child->num_; y += child->y_ * child->num_; z += child->z_ * child->num_;
+		if constexpr (Layout::contentBounds) {
+			if (first) { node->contMin_ = child->contMin_; node->contMax_ = child->contMax_; first = false; }
+			node->contMin_ = vec3{ std::min(node->contMin_.x_, child->contMin_.x_), std::min(node->contMin_.y_, child->contMin_.y_), std::min(node->contMin_.z_, child->contMin_.z_) };
+			node->contMax_ = vec3{ std::max(node->contMax_.x_, child->contMax_.x_), std::max(node->contMax_.y_, child->contMax_.y_), std::max(node->contMax_.z_, child->contMax_.z_) };
+		}
+	}
+	if (node->num_ > 0) {
+		node->setX(x / node->num_); node->setY(y / node->num_); node->setZ(z / node->num_);
+	}
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::refitAncestors(Node<Tname, Layout>* node, int frontierDepth) {
+	if (node->depth_ == frontierDepth || !node->hasChildren()) { return; }  // subtree already refit by a worker
+	for (int i = 0; i < node->numChildren(); i++) {
+		refitAncestors(node->child_[i], frontierDepth);
+	}
+	combineRefit(node);
+}
+
+template <typename Tname, typename Instr, typename Layout> typename Octree<Tname, Instr, Layout>::RefitQuality Octree<Tname, Instr, Layout>::refit(int numThreads) {
+	std::vector<Node<Tname, Layout>*> tasks;
+	int frontierDepth = getFrontier(numThreads, tasks);
+	int numTasks = (int)tasks.size();
+	std::vector<RefitQuality> taskQuality(numTasks, RefitQuality{ 0, 0, 0 });
+	parallelFor(numTasks, numThreads, [&](int t) {
+		refitNode(tasks[t], taskQuality[t]);
+	});
+	refitAncestors(root_, frontierDepth);
+	RefitQuality quality{ 0, 0, 0 };
+	for (RefitQuality& q : taskQuality) {
+		quality.misplaced_ += q.misplaced_;
+		quality.maxOverhang_ = std::max(quality.maxOverhang_, q.maxOverhang_);
+	}
+	quality.misplacedFraction_ = (root_->num_ > 0) ? (double)quality.misplaced_ / root_->num_ : 0;
+	return quality;
+}
+
+// Octree collision functions
+template <typename Tname, typename Instr, typename Layout> std::vector<std::pair<Tname*, Tname*>> Octree<Tname, Instr, Layout>::collidePairs(int numThreads) {
+	static_assert(Layout::contentBounds, "collidePairs() prunes with the content bounds, so the layout must store them");
+	std::vector<std::pair<Tname*, Tname*>> pairs;
+	if (root_->num_ == 0) { return pairs; }
+	refit(numThreads);  // loose bounds of every node from the current boxes
+
+	// Leaf boxes are computed once, as a leaf is tested against each of its overlapping neighbours
+	LeafBoxes boxes;
+	std::vector<Node<Tname, Layout>*> leaves;
+	std::vector<Node<Tname, Layout>*> stack{ root_ };
+	int total = 0;
+	while (!stack.empty()) {
+		Node<Tname, Layout>* node = stack.back(); stack.pop_back();
+		if (node->hasChildren()) {
+			for (int i = 0; i < node->numChildren(); i++) { stack.push_back(node->child_[i]); }
+		}
+		else if (node->num_ > 0) {
+			boxes.offset_[node] = total;
+			leaves.push_back(node);
+			total += node->num_;
+		}
+	}
+	boxes.boxes_.resize(total);
+	parallelFor((int)leaves.size(), numThreads, [&](int l) {
+		box3* out = &boxes.boxes_[boxes.offset_.at(leaves[l])];
+		for (int j = 0; j < leaves[l]->num_; j++) { out[j] = getBox(leaves[l]->Objs_[j]); }
+	});
+
+	// Node pairs above the frontier are expanded serially, then workers finish the pairs below it
+	std::vector<Node<Tname, Layout>*> frontier;
+	int frontierDepth = getFrontier(numThreads, frontier);
+	CollideTasks deferred;
+	collideNodes(root_, root_, boxes, pairs, frontierDepth, &deferred);
+	std::vector<std::vector<std::pair<Tname*, Tname*>>> taskPairs(deferred.size());
+	parallelFor((int)deferred.size(), numThreads, [&](int t) {
+		collideNodes(deferred[t].first, deferred[t].second, boxes, taskPairs[t]);
+	});
+	for (std::vector<std::pair<Tname*, Tname*>>& found : taskPairs) {
+		pairs.insert(pairs.end(), found.begin(), found.end());
+	}
+	return pairs;
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::collideNodes(Node<Tname, Layout>* a, Node<Tname, Layout>* b, const LeafBoxes& boxes, std::vector<std::pair<Tname*, Tname*>>& pairs, int frontierDepth, CollideTasks* deferred) const {
+	if (a->num_ == 0 || b->num_ == 0) { return; }
+	if (a != b && !box3{ a->contMin_, a->contMax_ }.overlaps(box3{ b->contMin_, b->contMax_ }, Layout::dims)) { return; }
+	if (!a->hasChildren() && !b->hasChildren()) {  // two leaves, or one leaf against itself
+		const box3* boxA = &boxes.boxes_[boxes.offset_.at(a)];
+		const box3* boxB = &boxes.boxes_[boxes.offset_.at(b)];
+		for (int i = 0; i < a->num_; i++) {
+			for (int j = (a == b) ? i + 1 : 0; j < b->num_; j++) {
+				if (boxA[i].overlaps(boxB[j], Layout::dims)) { pairs.push_back({ &a->Objs_[i], &b->Objs_[j] }); }
+			}
+		}
+		return;
+	}
+	// Descend into the shallower internal node, so both sides shrink at a similar rate
+	bool splitA = a->hasChildren() && (!b->hasChildren() || a->depth_ <= b->depth_);
+	Node<Tname, Layout>* split = splitA ? a : b;
+	if (deferred && split->depth_ >= frontierDepth) {
+		deferred->push_back({ a, b });
+		return;
+	}
+	Instr::count(OctreeCounter::NodesVisited);
+	if (a == b) {  // pairs within each child, then between each pair of children
+		for (int i = 0; i < a->numChildren(); i++) {
+			collideNodes(a->child_[i], a->child_[i], boxes, pairs, frontierDepth, deferred);
+			for (int j = i + 1; j < a->numChildren(); j++) {
+				collideNodes(a->child_[i], a->child_[j], boxes, pairs, frontierDepth, deferred);
+			}
+		}
+	}
+	else if (splitA) {
+		for (int i = 0; i < a->numChildren(); i++) { collideNodes(a->child_[i], b, boxes, pairs, frontierDepth, deferred); }
+	}
+	else {
+		for (int i = 0; i < b->numChildren(); i++) { collideNodes(a, b->child_[i], boxes, pairs, frontierDepth, deferred); }
+	}
+}
+
+// Octree ray casting functions
+template <typename Tname, typename Instr, typename Layout> vec3 Octree<Tname, Instr, Layout>::rayInverse(const vec3& dir) {
+	// A zero component becomes 1e300, so a parallel slab gives huge finite times instead of inf * 0
+	return vec3{ 1 / (dir.x_ != 0 ? dir.x_ : 1e-300), 1 / (dir.y_ != 0 ? dir.y_ : 1e-300), 1 / (dir.z_ != 0 ? dir.z_ : 1e-300) };
+}
+
+template <typename Tname, typename Instr, typename Layout> bool Octree<Tname, Instr, Layout>::raySlab(const Node<Tname, Layout>* node, const vec3& origin, const vec3& inv, double tmax, double& tEnter, double& tExit) {
+	double t1 = (node->xMin_ - origin.x_) * inv.x_, t2 = (node->xMax_ - origin.x_) * inv.x_;
+	tEnter = std::min(t1, t2); tExit = std::max(t1, t2);
+	t1 = (node->yMin_ - origin.y_) * inv.y_; t2 = (node->yMax_ - origin.y_) * inv.y_;
+	tEnter = std::max(tEnter, std::min(t1, t2)); tExit = std::min(tExit, std::max(t1, t2));
+	if constexpr (Layout::dims == 3) {
+		t1 = (node->zMin_ - origin.z_) * inv.z_; t2 = (node->zMax_ - origin.z_) * inv.z_;
+		tEnter = std::max(tEnter, std::min(t1, t2)); tExit = std::min(tExit, std::max(t1, t2));
+	}
+	tEnter = std::max(tEnter, 0.0); tExit = std::min(tExit, tmax);
+	return tEnter <= tExit;
+}
+
+template <typename Tname, typename Instr, typename Layout> uint8_t Octree<Tname, Instr, Layout>::packetSlab(const Node<Tname, Layout>* node, const RayPacket& P, uint8_t active, double* tEnter, double* tExit) {
+	unsigned hits = 0;
+	for (int l = 0; l < 8; l++) {  // branch free over the lanes, so the compiler can test them together
+		double t1 = (node->xMin_ - P.ox_[l]) * P.ix_[l], t2 = (node->xMax_ - P.ox_[l]) * P.ix_[l];
+		double tNear = std::min(t1, t2), tFar = std::max(t1, t2);
+		t1 = (node->yMin_ - P.oy_[l]) * P.iy_[l]; t2 = (node->yMax_ - P.oy_[l]) * P.iy_[l];
+		tNear = std::max(tNear, std::min(t1, t2)); tFar = std::min(tFar, std::max(t1, t2));
+		if constexpr (Layout::dims == 3) {
+			t1 = (node->zMin_ - P.oz_[l]) * P.iz_[l]; t2 = (node->zMax_ - P.oz_[l]) * P.iz_[l];
+			tNear = std::max(tNear, std::min(t1, t2)); tFar = std::min(tFar, std::max(t1, t2));
+		}
+		tNear = std::max(tNear, 0.0); tFar = std::min(tFar, P.tmax_[l]);
+		tEnter[l] = tNear; tExit[l] = tFar;
+		hits |= (unsigned)(tNear <= tFar) << l;
+	}
+	return (uint8_t)(hits & active);
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template <typename F>
+Node<Tname, Layout>* Octree<Tname, Instr, Layout>::raycast(const vec3& origin, const vec3& dir, double tmax, F&& visit) const {
+	vec3 inv = rayInverse(dir);
+	double tEnter, tExit;
+	if (root_->num_ == 0 || !raySlab(root_, origin, inv, tmax, tEnter, tExit)) { return nullptr; }
+	return raycastNode(root_, origin, inv, tEnter, tExit, tmax, visit);
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template <typename F>
+Node<Tname, Layout>* Octree<Tname, Instr, Layout>::raycastNode(Node<Tname, Layout>* node, const vec3& origin, const vec3& inv, double tEnter, double tExit, double tmax, F& visit) const {
+	Instr::count(OctreeCounter::NodesVisited);
+	if (!node->hasChildren()) {
+		return (node->num_ > 0 && visit(node, tEnter, tExit)) ? node : nullptr;
+	}
+	// Cells are disjoint boxes, so sorting the crossed children by entry time gives their order along the ray
+	struct Crossed { Node<Tname, Layout>* node_; double tEnter_, tExit_; } crossed[8];
+	int numCrossed = 0;
+	for (int i = 0; i < node->numChildren(); i++) {
+		Node<Tname, Layout>* child = node->child_[i];
+		double t0, t1;
+		if (child->num_ == 0 || !raySlab(child, origin, inv, tmax, t0, t1)) { continue; }
+		int k = numCrossed++;
+		for (; k > 0 && crossed[k - 1].tEnter_ > t0; k--) { crossed[k] = crossed[k - 1]; }  // insertion sort, at most 8 children
+		crossed[k] = Crossed{ child, t0, t1 };
+	}
+	for (int k = 0; k < numCrossed; k++) {
+		Node<Tname, Layout>* hit = raycastNode(crossed[k].node_, origin, inv, crossed[k].tEnter_, crossed[k].tExit_, tmax, visit);
+		if (hit) { return hit; }
+	}
+	return nullptr;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template <typename F>
+uint8_t Octree<Tname, Instr, Layout>::raycast8(const vec3 origins[8], const vec3 dirs[8], double tmax[8], F&& visit) const {
+	RayPacket P;
+	for (int l = 0; l < 8; l++) {
+		vec3 inv = rayInverse(dirs[l]);
+		P.ox_[l] = origins[l].x_; P.oy_[l] = origins[l].y_; P.oz_[l] = origins[l].z_;
+		P.ix_[l] = inv.x_; P.iy_[l] = inv.y_; P.iz_[l] = inv.z_;
+		P.tmax_[l] = tmax[l];
+	}
+	P.stopped_ = 0;
+	// Lanes are split by their direction signs, as only rays sharing them cross children in the same order
+	uint8_t signGroups[8] = {};
+	for (int l = 0; l < 8; l++) { signGroups[(dirs[l].y_ < 0) + 2 * (dirs[l].x_ < 0) + 4 * (Layout::dims == 3 && dirs[l].z_ < 0)] |= (uint8_t)(1u << l); }
+	double tEnter[8], tExit[8];
+	for (int s = 0; s < 8; s++) {
+		if (!signGroups[s]) { continue; }
+		P.signs_ = s;
+		uint8_t active = packetSlab(root_, P, signGroups[s], tEnter, tExit);
+		if (root_->num_ > 0 && active) { packetNode(root_, P, active, tEnter, tExit, visit); }
+	}
+	for (int l = 0; l < 8; l++) { tmax[l] = P.tmax_[l]; }
+	return P.stopped_;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template <typename F>
+void Octree<Tname, Instr, Layout>::packetNode(Node<Tname, Layout>* node, RayPacket& P, uint8_t active, const double* tEnter, const double* tExit, F& visit) const {
+	Instr::count(OctreeCounter::NodesVisited);
+	if (!node->hasChildren()) {
+		if (node->num_ == 0) { return; }
+		active &= (uint8_t)~P.stopped_;  // a lane stops at its first hit, as in raycast()
+		for (int l = 0; l < 8; l++) {
+			if (((active >> l) & 1) && visit(l, node, tEnter[l], tExit[l])) {
+				P.stopped_ |= (uint8_t)(1u << l);
+				P.tmax_[l] = std::min(P.tmax_[l], tExit[l]);  // reported back as the hit's exit
+			}
+		}
+		return;
+	}
+	// A ray never crosses back over a split plane, so with the index bits of negative directions flipped, children are visited in increasing index for every lane
+	for (int k = 0; k < 8; k++) {
+		Node<Tname, Layout>* child = node->getChild(k ^ P.signs_);
+		if (!child || child->num_ == 0) { continue; }
+		active &= (uint8_t)~P.stopped_;  // lanes that stopped in an earlier child go no further
+		if (!active) { return; }
+		double childEnter[8], childExit[8];
+		uint8_t lanes = packetSlab(child, P, active, childEnter, childExit);
+		if (lanes) { packetNode(child, P, lanes, childEnter, childExit, visit); }
+	}
+}
+
+// Octree culling functions
+template <typename Tname, typename Instr, typename Layout>
+template <typename F>
+bool Octree<Tname, Instr, Layout>::cullFrustum(const plane3* planes, int numPlanes, F&& visit) const {
+	if (numPlanes > 32) { return false; }  // the crossed planes are tracked in a 32 bit mask
+	// Each node carries the mask of planes its parent still crossed, the rest are known to be passed
+	std::vector<std::pair<Node<Tname, Layout>*, uint32_t>> stack{ { root_, (numPlanes == 32) ? ~0u : (1u << numPlanes) - 1 } };
+	while (!stack.empty()) {
+		auto [node, mask] = stack.back(); stack.pop_back();
+		Instr::count(OctreeCounter::NodesVisited);
+		if (node->num_ == 0) { continue; }
+		bool outside = false;
+		for (uint32_t bits = mask; bits; bits &= bits - 1) {
+			int p = std::countr_zero(bits);
+			const vec3& n = planes[p].normal_;
+			// Corners of the cell furthest along and against the normal
+			vec3 ahead{ (n.x_ >= 0) ? node->xMax_ : node->xMin_, (n.y_ >= 0) ? node->yMax_ : node->yMin_, (n.z_ >= 0) ? (double)node->zMax_ : (double)node->zMin_ };
+			vec3 behind{ (n.x_ >= 0) ? node->xMin_ : node->xMax_, (n.y_ >= 0) ? node->yMin_ : node->yMax_, (n.z_ >= 0) ? (double)node->zMin_ : (double)node->zMax_ };
+			if (planes[p].distance(ahead) < 0) { outside = true; break; }
+			if (planes[p].distance(behind) >= 0) { mask &= ~(1u << p); }  // whole cell passes, children skip this plane
+		}
+		if (outside) { continue; }
+		if (mask == 0) { visit(node, true); }  // inside every plane, emitted with its whole subtree
+		else if (node->hasChildren()) {
+			for (int i = 0; i < node->numChildren(); i++) { stack.push_back({ node->child_[i], mask }); }
+		}
+		else { visit(node, false); }  // crossing leaf, its objects need testing
+	}
+	return true;
+}
+
+// Octree node table functions
+template <typename Tname, typename Instr, typename Layout> bool Octree<Tname, Instr, Layout>::buildNodeTable() {
+	static_assert(Layout::split == SplitRule::Midpoint, "cell keys are computed by halving the root cell, so splits must be midpoints");
+	clearNodeTable();
+	if ((maxDepth_ - root_->depth_) * Layout::dims + 1 > 64) { return false; }  // keys to maxDepth_ don't fit, lookups find nothing
+	std::vector<std::pair<Node<Tname, Layout>*, uint64_t>> cells;  // every node with its key, parents first
+	std::vector<long long> objsAtLevel(maxDepth_ - root_->depth_ + 1, 0);
+	cells.push_back({ root_, 1 });
+	for (size_t c = 0; c < cells.size(); c++) {
+		auto [node, key] = cells[c];
+		if (!node->hasChildren()) { objsAtLevel[node->depth_ - root_->depth_] += node->num_; }
+		for (int i = 0; i < 8; i++) {
+			Node<Tname, Layout>* child = node->getChild(i);
+			if (child) { cells.push_back({ child, (key << Layout::dims) | (uint64_t)i }); }
+		}
+	}
+	tableHint_ = (int)(std::max_element(objsAtLevel.begin(), objsAtLevel.end()) - objsAtLevel.begin());
+	// At most half full, so probes stay short
+	size_t size = std::bit_ceil(2 * cells.size());
+	tableShift_ = 64 - std::countr_zero(size);
+	nodeTable_.assign(size, { 0, nullptr });
+	for (auto [node, key] : cells) {
+		size_t i = (size_t)((key * 0x9E3779B97F4A7C15ull) >> tableShift_);
+		while (nodeTable_[i].first != 0) { i = (i + 1) & (size - 1); }
+		nodeTable_[i] = { key, node };
+	}
+	return true;
+}
+
+template <typename Tname, typename Instr, typename Layout> uint64_t Octree<Tname, Instr, Layout>::getCellKey(const vec3& V, int depth) const {
+	// Halving the root cell with the same arithmetic as build() reproduces the nodes' bounds exactly
+	double xMax = root_->xMax_, xMin = root_->xMin_, yMax = root_->yMax_, yMin = root_->yMin_, zMax = root_->zMax_, zMin = root_->zMin_;
+	uint64_t key = 1;
+	for (int d = root_->depth_; d < depth; d++) {
+		double xCent = (xMax + xMin) / 2, yCent = (yMax + yMin) / 2, zCent = (zMax + zMin) / 2;
+		bool up = V.y_ > yCent, right = V.x_ > xCent, top = Layout::dims == 3 && V.z_ > zCent;
+		key = (key << Layout::dims) | (uint64_t)(up + 2 * right + 4 * top);
+		yMin = up ? yCent : yMin; yMax = up ? yMax : yCent;  // selects rather than branches, as query points are unpredictable
+		xMin = right ? xCent : xMin; xMax = right ? xMax : xCent;
+		zMin = top ? zCent : zMin; zMax = top ? zMax : zCent;
+	}
+	return key;
+}
+
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::lookupNode(int depth, const vec3& V) const {
+	if (nodeTable_.empty() || depth < root_->depth_ || depth > maxDepth_ || !root_->contains(V)) { return nullptr; }
+	return findCell(getCellKey(V, depth));
+}
+
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::lookupLeaf(const vec3& V) const {
+	if (nodeTable_.empty() || !root_->contains(V)) { return nullptr; }
+	// Every ancestor of the leaf holding V is present and nothing below it is, so search the levels of V's deepest key,
+	// starting from the level holding most leaves' objects
+	int levels = maxDepth_ - root_->depth_;
+	uint64_t key = getCellKey(V, maxDepth_);
+	int lo = 0, hi = levels;  // deepest level known present, deepest level possibly present
+	Node<Tname, Layout>* node = root_;
+	for (int mid = tableHint_; lo < hi; mid = (lo + hi + 1) / 2) {
+		Instr::count(OctreeCounter::NodesVisited);
+		Node<Tname, Layout>* found = findCell(key >> (Layout::dims * (levels - mid)));
+		if (!found) { hi = mid - 1; continue; }
+		lo = mid; node = found;
+		if (!found->hasChildren()) { break; }  // the leaf itself
+	}
+	return node->hasChildren() ? nullptr : node;  // an internal node means V's octant below it is empty
+}
+
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::lookupParent(const Node<Tname, Layout>* node) const {
+	if (nodeTable_.empty() || node->depth_ <= root_->depth_) { return nullptr; }
+	vec3 centre{ (node->xMax_ + node->xMin_) / 2, (node->yMax_ + node->yMin_) / 2, ((double)node->zMax_ + (double)node->zMin_) / 2 };
+	return findCell(getCellKey(centre, node->depth_) >> Layout::dims);
+}
+
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::lookupNeighbour(const Node<Tname, Layout>* node, int dx, int dy, int dz) const {
+	if (nodeTable_.empty()) { return nullptr; }
+	int levels = node->depth_ - root_->depth_;
+	vec3 centre{ (node->xMax_ + node->xMin_) / 2, (node->yMax_ + node->yMin_) / 2, ((double)node->zMax_ + (double)node->zMin_) / 2 };
+	uint64_t key = getCellKey(centre, node->depth_);
+	// The octant bits of each level are the next bits of the cell's integer coordinates, y in bit 0, x in bit 1 and z in bit 2
+	int64_t ix = 0, iy = 0, iz = 0;
+	for (int l = levels - 1; l >= 0; l--) {
+		uint64_t octant = key >> (Layout::dims * l);
+		iy = (iy << 1) | (int64_t)(octant & 1); ix = (ix << 1) | (int64_t)((octant >> 1) & 1); iz = (iz << 1) | (int64_t)((Layout::dims == 3) ? (octant >> 2) & 1 : 0);
+	}
+	ix += dx; iy += dy;
+	if constexpr (Layout::dims == 3) { iz += dz; }
+	int64_t cells = (int64_t)1 << levels;
+	if (ix < 0 || ix >= cells || iy < 0 || iy >= cells || iz < 0 || iz >= cells) { return nullptr; }  // outside the root
+	key = 1;
+	for (int l = levels - 1; l >= 0; l--) {
+		uint64_t octant = ((iy >> l) & 1) | (((ix >> l) & 1) << 1) | ((Layout::dims == 3) ? (((iz >> l) & 1) << 2) : 0);
+		key = (key << Layout::dims) | octant;
+	}
+	return findCell(key);
+}
+
+// Octree level of detail functions
+template <typename Tname, typename Instr, typename Layout>
+template <typename F>
+std::vector<typename Octree<Tname, Instr, Layout>::CutNode> Octree<Tname, Instr, Layout>::extractCut(F&& stop, int numThreads) const {
+	static_assert(Layout::centreOfData, "a cut represents each node by its c.o.d., so the layout must store it");
+	// Nodes above the frontier are cut serially, leaving a gap for each subtree below it, which workers then cut
+	std::vector<Node<Tname, Layout>*> frontier;
+	int frontierDepth = getFrontier(numThreads, frontier);
+	std::vector<CutNode> cut;
+	CutTasks deferred;
+	cutNode(root_, stop, cut, frontierDepth, &deferred);
+	if (deferred.empty()) { return cut; }
+	std::vector<std::vector<CutNode>> taskCuts(deferred.size());
+	parallelFor((int)deferred.size(), numThreads, [&](int t) {
+		cutNode(deferred[t].first, stop, taskCuts[t]);
+	});
+	// Splice the subtrees' cuts into their gaps, keeping depth first order
+	size_t total = cut.size();
+	for (std::vector<CutNode>& taskCut : taskCuts) { total += taskCut.size(); }
+	std::vector<CutNode> ordered;
+	ordered.reserve(total);
+	size_t next = 0;
+	for (size_t t = 0; t < deferred.size(); t++) {
+		ordered.insert(ordered.end(), cut.begin() + next, cut.begin() + deferred[t].second);
+		ordered.insert(ordered.end(), taskCuts[t].begin(), taskCuts[t].end());
+		next = deferred[t].second;
+	}
+	ordered.insert(ordered.end(), cut.begin() + next, cut.end());
+	return ordered;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template <typename F>
+void Octree<Tname, Instr, Layout>::cutNode(const Node<Tname, Layout>* node, F& stop, std::vector<CutNode>& cut, int frontierDepth, CutTasks* deferred) const {
+	Instr::count(OctreeCounter::NodesVisited);
+	if (node->num_ == 0) { return; }
+	if (!node->hasChildren() || stop(node)) {
+		cut.push_back(CutNode{ vec3{ node->x_, node->y_, node->z_ }, node->num_, node });
+		return;
+	}
+	if (deferred && node->depth_ == frontierDepth) {
+		deferred->push_back({ node, cut.size() });
+		return;
+	}
+	for (int i = 0; i < node->numChildren(); i++) {
+		cutNode(node->child_[i], stop, cut, frontierDepth, deferred);
+	}
+}
+
+// Octree synchronisation functions
+template <typename Tname, typename Instr, typename Layout> double Octree<Tname, Instr, Layout>::estimateDisplaced(int sampleSize) const {
+	if (root_->num_ == 0 || sampleSize <= 0) { return 0; }
+	int stride = std::max(1, root_->num_ / sampleSize);
+	int sampled = 0, displaced = 0, index = 0;
+	std::vector<Node<Tname, Layout>*> stack{ root_ };
+	while (!stack.empty()) {  // check every stride-th object in leaf order
+		Node<Tname, Layout>* node = stack.back(); stack.pop_back();
+		if (node->hasChildren()) {
+			for (int i = 0; i < node->numChildren(); i++) { stack.push_back(node->child_[i]); }
+			continue;
+		}
+		int j = (stride - index % stride) % stride;
+		for (; j < node->num_; j += stride) {
+			if (!node->contains(getCoords(node->Objs_[j]))) { displaced++; }
+			sampled++;
+		}
+		index += node->num_;
+	}
+	return (sampled > 0) ? (double)displaced / sampled : 0;
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::drainNode(Node<Tname, Layout>* node, Tname* ObjArr, int& counter) {
+	if (node->hasChildren()) {
+		for (int i = 0; i < node->numChildren(); i++) {
+			drainNode(node->child_[i], ObjArr, counter);
+		}
+		return;
+	}
+	for (int j = 0; j < node->num_; j++) {
+		transfer(ObjArr[counter], node->Objs_[j]);
+		counter++;
+	}
+}
+
+template <typename Tname, typename Instr, typename Layout> Tname* Octree<Tname, Instr, Layout>::rebuildTree() {
+	clearNodeTable();
+	int size = root_->num_;
+	Tname* Objects = new Tname[size];
+	int counter = 0;
+	drainNode(root_, Objects, counter);
+	root_->clearChildren();  // delete children
+	if (root_->Objs_) { delete[] root_->Objs_; }
+	// Objects that left the root bounds are returned, as updateTree() would
+	Tname* inside = new Tname[size];
+	std::vector<int> outside;
+	int numInside = 0;
+	for (int i = 0; i < size; i++) {
+		if (root_->contains(getCoords(Objects[i]))) {
+			transfer(inside[numInside], Objects[i]);
+			numInside++;
+		}
+		else {
+			outside.push_back(i);
+		}
 	}
-	for (int i = 7; i >= 0; i--) {
-		if (root_->child_[i]) { delete root_->child_[i]; }  // delete children
-		root_->child_[i] = nullptr;
+	Tname* lostObjs = nullptr;
+	if (!outside.empty()) {
+		lostObjs = new Tname[outside.size()];
+		for (int i = 0; i < (int)outside.size(); i++) {
+			transfer(lostObjs[i], Objects[outside[i]]);
+		}
 	}
 	delete[] Objects;
-	root_->Objs_ = allObjects;
+	root_->Objs_ = inside;
+	root_->num_ = numInside;
+	root_->leaf_ = false;
 	root_->x_ = 0; root_->y_ = 0; root_->z_ = 0;  // reinitialise root C.o.D.
 	build(root_);  // rebuild tree
-	return;
+	return lostObjs;
 }
 
-template <typename Tname>
-template<moveable>
-void Octree<Tname>::addToTree(Tname* ObjArr, int size) {
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::rebuildWith(Tname* ObjArr, int size) {
+	clearNodeTable();
 	int treeTot = root_->num_ + size;
-	Tname* Objects = moveTreeData(root_);  // get data
-	root_->num_ = treeTot;  // add to root size
 	Tname* allObjects = new Tname[treeTot];
-	for (int j = 0; j < root_->num_ - size; j++) {
-		allObjects[j] = std::move(Objects[j]);
-	}
+	int counter = 0;
+	drainNode(root_, allObjects, counter);  // get data
 	for (int j = 0; j < size; j++) {
-		allObjects[root_->num_ - size + j] = std::move(ObjArr[j]);  // copy over array of objects
+		transfer(allObjects[counter + j], ObjArr[j]);  // add array of objects
 	}
-	for (int i = 7; i >= 0; i--) {
-		if (root_->child_[i]) { delete root_->child_[i]; }  // delete children
-		root_->child_[i] = nullptr;
-	}
-	delete[] Objects;
-	root_->Objs_ = std::move(allObjects);
+	root_->clearChildren();  // delete children
+	if (root_->Objs_) { delete[] root_->Objs_; }
+	root_->Objs_ = allObjects;
+	root_->num_ = treeTot;  // add to root size
+	root_->leaf_ = false;
 	root_->x_ = 0; root_->y_ = 0; root_->z_ = 0;  // reinitialise root C.o.D.
 	build(root_);  // rebuild tree
-	return;
+}
+
+template <typename Tname, typename Instr, typename Layout> Tname* Octree<Tname, Instr, Layout>::synchronize(double displacedFraction, int numThreads, int sampleSize) {
+	clearNodeTable();
+	SyncReport report;
+	int size = root_->num_;
+	auto t0 = std::chrono::steady_clock::now();
+	if (displacedFraction < 0) {  // no hint from the caller, so sample
+		displacedFraction = estimateDisplaced(sampleSize);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	double displaced = displacedFraction * size;
+	report.displacedFraction_ = displacedFraction;
+	report.estimateTime_ = std::chrono::duration<double>(t1 - t0).count();
+	report.refitEstimate_ = syncModel_.refitCost_ * size;
+	report.updateEstimate_ = syncModel_.refitCost_ * size + syncModel_.updateMoveCost_ * displaced;
+	report.rebuildEstimate_ = syncModel_.rebuildCost_ * size;
+	if (displacedFraction <= syncModel_.refitTolerance_) {
+		report.action_ = SyncAction::Refit;
+	}
+	else {
+		report.action_ = (report.updateEstimate_ <= report.rebuildEstimate_) ? SyncAction::Update : SyncAction::Rebuild;
+	}
+
+	Tname* lostObjs = nullptr;
+	if (report.action_ == SyncAction::Refit) { refit(numThreads); }
+	else if (report.action_ == SyncAction::Update) { lostObjs = parallelUpdateTree(numThreads); }
+	else { lostObjs = rebuildTree(); }
+	auto t2 = std::chrono::steady_clock::now();
+	report.actionTime_ = std::chrono::duration<double>(t2 - t1).count();
+
+	// Fold the measured time back into the cost model
+	if (size > 0) {
+		double w = syncModel_.smoothing_;
+		if (report.action_ == SyncAction::Refit) {
+			syncModel_.refitCost_ = (1 - w) * syncModel_.refitCost_ + w * report.actionTime_ / size;
+		}
+		else if (report.action_ == SyncAction::Update && displaced >= 1) {
+			double moveTime = std::max(0.0, report.actionTime_ - syncModel_.refitCost_ * size);
+			syncModel_.updateMoveCost_ = (1 - w) * syncModel_.updateMoveCost_ + w * moveTime / displaced;
+		}
+		else if (report.action_ == SyncAction::Rebuild) {
+			syncModel_.rebuildCost_ = (1 - w) * syncModel_.rebuildCost_ + w * report.actionTime_ / size;
+		}
+	}
+	lastSync_ = report;
+	return lostObjs;
+}
+
+// Octree buffered insertion functions
+template <typename Tname, typename Instr, typename Layout> uint64_t Octree<Tname, Instr, Layout>::getMortonKey(const vec3& V) const {
+	if constexpr (Layout::split != SplitRule::Midpoint) {  // cells aren't halves, so follow the stored split planes and halve below the deepest node
+		const Node<Tname, Layout>* node = root_;
+		vec3 lo{ root_->xMin_, root_->yMin_, root_->zMin_ }, hi{ root_->xMax_, root_->yMax_, root_->zMax_ };
+		uint64_t key = 0;
+		for (int b = 20; b >= 0; b--) {
+			vec3 split = (node && node->hasChildren()) ? node->getSplit() : 0.5 * (lo + hi);
+			int octant = (V.y_ > split.y_) + 2 * (V.x_ > split.x_) + ((Layout::dims == 3) ? 4 * (V.z_ > split.z_) : 0);
+			key = (key << 3) | (uint64_t)octant;
+			if (octant & 1) { lo.y_ = split.y_; } else { hi.y_ = split.y_; }
+			if (octant & 2) { lo.x_ = split.x_; } else { hi.x_ = split.x_; }
+			if (octant & 4) { lo.z_ = split.z_; } else { hi.z_ = split.z_; }
+			node = (node && node->hasChildren()) ? node->getChild(octant) : nullptr;
+		}
+		return key;
+	}
+	// 21 bits per axis, interleaved per level as z, x, y to match the child_ numbering in build()
+	const double cells = (double)(1 << 21);
+	auto quantise = [cells](double v, double lo, double hi) -> uint64_t {
+		double t = (hi > lo) ? (v - lo) / (hi - lo) * cells : 0;
+		return (uint64_t)std::clamp(t, 0.0, cells - 1);
+	};
+	uint64_t x = quantise(V.x_, root_->xMin_, root_->xMax_);
+	uint64_t y = quantise(V.y_, root_->yMin_, root_->yMax_);
+	uint64_t z = quantise(V.z_, root_->zMin_, root_->zMax_);
+	uint64_t key = 0;
+	for (int b = 20; b >= 0; b--) {
+		key = (key << 3) | (((z >> b) & 1) << 2) | (((x >> b) & 1) << 1) | ((y >> b) & 1);
+	}
+	return key;
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::stage(Tname Obj) {
+	staged_.emplace_back();
+	transfer(staged_.back(), Obj);
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::flush() {
+	std::vector<MovedObj> objs(staged_.size());
+	for (int i = 0; i < (int)staged_.size(); i++) {
+		objs[i].coords = getCoords(staged_[i]);  // using function provided to get obj coords
+		transfer(objs[i].obj, staged_[i]);
+	}
+	staged_.clear();
+	mergeObjs(objs);
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::mergeObjs(std::vector<MovedObj>& objs) {
+	clearNodeTable();
+	int size = (int)objs.size();
+	if (size == 0) { return; }
+	bool inBounds = true;
+	for (int i = 0; i < size; i++) {
+		inBounds = inBounds && root_->contains(objs[i].coords);
+	}
+	if (!inBounds || !root_->hasChildren()) {  // bounds must grow, so rebuild once with everything
+		Tname* ObjArr = new Tname[size];
+		for (int i = 0; i < size; i++) {
+			transfer(ObjArr[i], objs[i].obj);
+		}
+		objs.clear();
+		rebuildWith(ObjArr, size);
+		delete[] ObjArr;
+		return;
+	}
+	// Sort into Morton order, so objects sharing a leaf are contiguous
+	std::vector<std::pair<uint64_t, int>> order(size);
+	for (int i = 0; i < size; i++) {
+		order[i] = { getMortonKey(objs[i].coords), i };
+	}
+	std::sort(order.begin(), order.end());
+	Node<Tname, Layout>* nextNode = makeLeaf(root_, objs[order[0].second].coords);
+	for (int start = 0; start < size;) {
+		Node<Tname, Layout>* destNode = nextNode;
+		int end = start + 1;
+		while (end < size) {
+			nextNode = makeLeaf(root_, objs[order[end].second].coords);
+			if (nextNode != destNode) { break; }
+			end++;
+		}
+		int count = end - start;
+		double x = 0, y = 0, z = 0;
+		Instr::count(OctreeCounter::Allocations);
+		Tname* destObjs = new Tname[destNode->num_ + count];  // merge the group in one allocation
+		for (int k = 0; k < destNode->num_; k++) {
+			transfer(destObjs[k], destNode->Objs_[k]);
+		}
+		for (int k = 0; k < count; k++) {
+			MovedObj& moved = objs[order[start + k].second];
+			transfer(destObjs[destNode->num_ + k], moved.obj);
+			x += moved.coords.x_; y += moved.coords.y_; z += moved.coords.z_;
+		}
+		if (destNode->Objs_) { delete[] destNode->Objs_; }
+		destNode->Objs_ = destObjs;
+		// Ancestors only gain objects, so their c.o.d. can be updated incrementally along the path down from the root
+		const vec3& V = objs[order[start].second].coords;
+		for (Node<Tname, Layout>* node = root_; node != nullptr; node = (node == destNode) ? nullptr : node->getChild(node->getOctant(V))) {
+			int newNum = node->num_ + count;
+			node->setX((node->x_ * node->num_ + x) / newNum);
+			node->setY((node->y_ * node->num_ + y) / newNum);
+			node->setZ((node->z_ * node->num_ + z) / newNum);
+			node->num_ = newNum;
+		}
+		destNode->leaf_ = true;
+		if ((destNode->num_ > maxLeaf_) && (destNode->depth_ != maxDepth_)) {  // split the leaf once
+			Instr::count(OctreeCounter::Splits);
+			destNode->x_ = 0; destNode->y_ = 0; destNode->z_ = 0;
+			destNode->leaf_ = false;
+			build(destNode, destNode->depth_);
+			if (end < size) { nextNode = makeLeaf(root_, objs[order[end].second].coords); }
+		}
+		start = end;
+	}
+	objs.clear();
+}
+
+// Octree concurrent insertion functions
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::concurrentInsert(Tname Obj) {
+	vec3 coords = getCoords(Obj);  // using function provided to get obj coords
+	Node<Tname, Layout>* destNode = root_->contains(coords) ? descendToLeaf(root_, coords) : nullptr;  // read-only traversal
+	// Objects for the same node always share a bucket, out of bounds objects use bucket 0
+	InsertBucket& bucket = getInsertBuckets()[std::hash<Node<Tname, Layout>*>()(destNode) % numInsertBuckets];
+	std::lock_guard<std::mutex> guard(bucket.lock_);
+	bucket.objs_.emplace_back();
+	transfer(bucket.objs_.back().obj, Obj);
+	bucket.objs_.back().coords = coords;
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::consolidate() {
+	InsertBucket* buckets = insertBuckets_.load(std::memory_order_acquire);
+	if (!buckets) { return; }  // nothing was ever inserted concurrently
+	std::vector<MovedObj> objs;
+	for (int b = 0; b < numInsertBuckets; b++) {
+		std::lock_guard<std::mutex> guard(buckets[b].lock_);
+		for (MovedObj& moved : buckets[b].objs_) {
+			objs.emplace_back();
+			transfer(objs.back().obj, moved.obj);
+			objs.back().coords = moved.coords;
+		}
+		buckets[b].objs_.clear();
+	}
+	mergeObjs(objs);  // splits and aggregate updates happen here, single threaded
+}
+
+// Octree statistics functions
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::statsNode(const Node<Tname, Layout>* node, OctreeStats& stats) const {
+	int level = node->depth_ - root_->depth_;  // 0 at the root
+	if ((int)stats.nodesByDepth_.size() <= level) { stats.nodesByDepth_.resize(level + 1, 0); }
+	stats.nodesByDepth_[level]++;
+	stats.numNodes_++;
+	stats.nodeBytes_ += sizeof(Node<Tname, Layout>) + node->numChildren() * sizeof(Node<Tname, Layout>*);
+	stats.maxDepth_ = std::max(stats.maxDepth_, node->depth_);
+	if (node->hasChildren()) {
+		stats.numInternal_++;
+		if (node->Objs_) { stats.slackBytes_ += node->num_ * sizeof(Tname); }  // stale array kept from before a split
+		for (int i = 0; i < node->numChildren(); i++) {
+			statsNode(node->child_[i], stats);
+		}
+		return;
+	}
+	if (node->num_ == 0) {
+		stats.numEmpty_++;
+		return;
+	}
+	stats.numLeaves_++;
+	stats.numObjs_ += node->num_;
+	stats.objBytes_ += node->num_ * sizeof(Tname);
+	stats.leafOccupancy_[std::min(node->num_, maxLeaf_ + 1)]++;
+	stats.meanLeafDepth_ += node->depth_;  // sums until stats() divides
+	stats.meanObjDepth_ += (double)node->depth_ * node->num_;
+}
+
+template <typename Tname, typename Instr, typename Layout> typename Octree<Tname, Instr, Layout>::OctreeStats Octree<Tname, Instr, Layout>::stats() const {
+	OctreeStats stats;
+	stats.leafOccupancy_.assign(maxLeaf_ + 2, 0);
+	stats.maxDepth_ = root_->depth_;
+	statsNode(root_, stats);
+	if (stats.numLeaves_ > 0) {
+		stats.meanLeafDepth_ /= stats.numLeaves_;
+		stats.meanObjDepth_ /= stats.numObjs_;
+	}
+	stats.slackBytes_ += (staged_.capacity() - staged_.size()) * sizeof(Tname);
+	return stats;
+}
+
+// Octree clone functions
+template <typename Tname, typename Instr, typename Layout> Node<Tname, Layout>* Octree<Tname, Instr, Layout>::cloneNode(const Node<Tname, Layout>* node, Node<Tname, Layout>* parent, int frontierDepth, CloneTasks* deferred) const {
+	Instr::count(OctreeCounter::NodesVisited);
+	Instr::count(OctreeCounter::Allocations);
+	Node<Tname, Layout>* copy = new Node<Tname, Layout>();
+	copy->parent_ = parent;
+	copy->x_ = node->x_; copy->y_ = node->y_; copy->z_ = node->z_;
+	copy->xMax_ = node->xMax_; copy->xMin_ = node->xMin_; copy->yMax_ = node->yMax_; copy->yMin_ = node->yMin_; copy->zMax_ = node->zMax_; copy->zMin_ = node->zMin_;
+	copy->num_ = node->num_;
+	copy->depth_ = node->depth_;
+	copy->leaf_ = node->leaf_;
+	copy->contMin_ = node->contMin_; copy->contMax_ = node->contMax_;
+	copy->split_ = node->split_;
+	copy->payload_ = node->payload_;
+	if (deferred && (node->depth_ == frontierDepth || !node->hasChildren())) {  // contents are copied later by a worker
+		deferred->push_back({ node, copy });
+		return copy;
+	}
+	cloneContents(node, copy, frontierDepth, deferred);
+	return copy;
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::cloneContents(const Node<Tname, Layout>* node, Node<Tname, Layout>* copy, int frontierDepth, CloneTasks* deferred) const {
+	if (node->hasChildren()) {  // the compact child_ arrays match one to one
+		copy->mask_ = node->mask_;
+		copy->child_ = new Node<Tname, Layout>*[node->numChildren()];
+		for (int i = 0; i < node->numChildren(); i++) {
+			copy->child_[i] = cloneNode(node->child_[i], copy, frontierDepth, deferred);
+		}
+	}
+	else if (node->num_ > 0) {  // only leaves own objects
+		Instr::count(OctreeCounter::Allocations);
+		Instr::count(OctreeCounter::ObjCopies, node->num_);
+		copy->Objs_ = new Tname[node->num_];
+		for (int j = 0; j < node->num_; j++) {
+			copy->Objs_[j] = node->Objs_[j];
+		}
+	}
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::cloneFrom(const Octree<Tname, Instr, Layout>& O, int numThreads) {
+	if (&O == this) { return; }  // no self assignment
+	if (root_) { delete root_; }
+	clearNodeTable();
+	// Nodes above the frontier are copied serially, then workers copy the subtrees below it
+	std::vector<Node<Tname, Layout>*> frontier;
+	int frontierDepth = O.getFrontier(numThreads, frontier);
+	CloneTasks deferred;
+	root_ = cloneNode(O.root_, nullptr, frontierDepth, &deferred);
+	parallelFor((int)deferred.size(), numThreads, [&](int t) {
+		cloneContents(deferred[t].first, deferred[t].second);
+	});
+	maxDepth_ = O.maxDepth_; maxLeaf_ = O.maxLeaf_;
+	func = O.func; funcCtx = O.funcCtx; funcContext = O.funcContext; boxFunc = O.boxFunc;
+	syncModel_ = O.syncModel_;
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::takeNodes(Octree<Tname, Instr, Layout>& O) {
+	if (&O == this) { return; }
+	if (root_) { delete root_; }
+	root_ = O.root_;
+	clearNodeTable(); O.clearNodeTable();
+	O.root_ = new Node<Tname, Layout>();  // O keeps its bounds and settings, with no objects
+	O.root_->xMax_ = root_->xMax_; O.root_->xMin_ = root_->xMin_; O.root_->yMax_ = root_->yMax_; O.root_->yMin_ = root_->yMin_; O.root_->zMax_ = root_->zMax_; O.root_->zMin_ = root_->zMin_;
+	O.root_->depth_ = root_->depth_;
+	maxDepth_ = O.maxDepth_; maxLeaf_ = O.maxLeaf_;
+	func = O.func; funcCtx = O.funcCtx; funcContext = O.funcContext; boxFunc = O.boxFunc;
+	syncModel_ = O.syncModel_;
+}
+
+// Octree merge functions
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::merge(Octree<Tname, Instr, Layout>&& O) {
+	clearNodeTable(); O.clearNodeTable();  // O's nodes are moved or freed
+	if (&O == this || O.root_->num_ == 0) { return; }
+	if (root_->num_ == 0 && !root_->hasChildren()) {  // nothing to merge into, so take O's nodes, bounds and settings whole
+		takeNodes(O);
+		return;
+	}
+	Node<Tname, Layout>* other = O.root_;
+	O.root_ = new Node<Tname, Layout>();  // O keeps its bounds and settings, with no objects
+	O.root_->xMax_ = other->xMax_; O.root_->xMin_ = other->xMin_; O.root_->yMax_ = other->yMax_; O.root_->yMin_ = other->yMin_; O.root_->zMax_ = other->zMax_; O.root_->zMin_ = other->zMin_;
+	O.root_->depth_ = other->depth_;
+	// Grow the root until it holds O's root, keeping the existing cells
+	bool aligned = growRoot(vec3{ other->xMin_, other->yMin_, other->zMin_ }, vec3{ other->xMax_, other->yMax_, other->zMax_ });
+	// O's nodes are kept only where the cells match and they respect this tree's limits
+	aligned = aligned && O.maxDepth_ <= maxDepth_ && O.maxLeaf_ <= maxLeaf_ && Layout::split == SplitRule::Midpoint && root_->xMax_ == other->xMax_ && root_->xMin_ == other->xMin_ && root_->yMax_ == other->yMax_ && root_->yMin_ == other->yMin_
+		&& root_->zMax_ == other->zMax_ && root_->zMin_ == other->zMin_;
+	if (aligned) {  // the same cells on both sides
+		mergeNode(root_, other);
+		return;
+	}
+	// Adaptive split planes or mismatched bounds, so the cells differ and O's objects are merged into leaves instead
+	int size = other->num_, counter = 0;
+	Tname* ObjArr = new Tname[size];
+	drainNode(other, ObjArr, counter);
+	delete other;
+	std::vector<MovedObj> objs(size);
+	for (int i = 0; i < size; i++) {
+		objs[i].coords = getCoords(ObjArr[i]);
+		transfer(objs[i].obj, ObjArr[i]);
+	}
+	delete[] ObjArr;
+	mergeObjs(objs);
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::mergeNode(Node<Tname, Layout>* node, Node<Tname, Layout>* other) {
+	Instr::count(OctreeCounter::NodesVisited);
+	if (other->num_ == 0) {
+		delete other;
+		return;
+	}
+	if (node->num_ == 0) {  // splice the other side's contents in whole
+		std::swap(node->Objs_, other->Objs_);
+		std::swap(node->child_, other->child_); std::swap(node->mask_, other->mask_);
+		node->x_ = other->x_; node->y_ = other->y_; node->z_ = other->z_;
+		node->num_ = other->num_;
+		node->leaf_ = other->leaf_;
+		node->split_ = other->split_;
+		node->contMin_ = other->contMin_; node->contMax_ = other->contMax_;
+		for (int i = 0; i < node->numChildren(); i++) {
+			node->child_[i]->parent_ = node;
+		}
+		delete other;
+		return;
+	}
+	if (!node->hasChildren() && !other->hasChildren()) {  // two leaves, one allocation and a split only if it overflows
+		int newNum = node->num_ + other->num_;
+		Instr::count(OctreeCounter::Allocations);
+		Tname* objs = new Tname[newNum];
+		for (int k = 0; k < node->num_; k++) {
+			transfer(objs[k], node->Objs_[k]);
+		}
+		for (int k = 0; k < other->num_; k++) {
+			transfer(objs[node->num_ + k], other->Objs_[k]);
+		}
+		node->setX((node->x_ * node->num_ + other->x_ * other->num_) / newNum);
+		node->setY((node->y_ * node->num_ + other->y_ * other->num_) / newNum);
+		node->setZ((node->z_ * node->num_ + other->z_ * other->num_) / newNum);
+		if (node->Objs_) { delete[] node->Objs_; }
+		node->Objs_ = objs;
+		node->num_ = newNum;
+		node->leaf_ = true;
+		delete other;
+		if ((node->num_ > maxLeaf_) && (node->depth_ != maxDepth_)) {
+			Instr::count(OctreeCounter::Splits);
+			node->x_ = 0; node->y_ = 0; node->z_ = 0;
+			node->leaf_ = false;
+			build(node, node->depth_);
+		}
+		return;
+	}
+	if (!node->hasChildren() || !other->hasChildren()) {  // a leaf facing an internal node is pushed down a level to meet its children
+		Node<Tname, Layout>* leaf = node->hasChildren() ? other : node;
+		Instr::count(OctreeCounter::Splits);
+		leaf->x_ = 0; leaf->y_ = 0; leaf->z_ = 0;
+		leaf->leaf_ = false;
+		build(leaf, leaf->depth_);
+	}
+	Node<Tname, Layout>* theirs[8];
+	for (int i = 0; i < 8; i++) {
+		theirs[i] = other->getChild(i);
+	}
+	delete[] other->child_;  // other no longer owns its children
+	other->child_ = nullptr; other->mask_ = 0;
+	delete other;
+	for (int i = 0; i < 8; i++) {
+		if (!theirs[i]) { continue; }
+		if (node->getChild(i)) {
+			mergeNode(node->getChild(i), theirs[i]);
+		}
+		else {  // splice the whole subtree into an absent octant
+			theirs[i]->parent_ = node;
+			node->addChild(i, theirs[i]);
+		}
+	}
+	combineChildren(node);
+}
+
+template <typename Tname, typename Instr, typename Layout> bool Octree<Tname, Instr, Layout>::growRoot(const vec3& lo, const vec3& hi) {
+	int levels = 0;
+	while (!root_->contains(lo) || !root_->contains(hi)) {
+		double xLen = root_->xMax_ - root_->xMin_, yLen = root_->yMax_ - root_->yMin_, zLen = root_->zMax_ - root_->zMin_;
+		if (xLen <= 0 || yLen <= 0 || (Layout::dims == 3 && zLen <= 0)) { break; }  // a flat root can't double
+		// The old root becomes the child_ on the side away from the box
+		int octant = (lo.y_ < root_->yMin_) + 2 * (lo.x_ < root_->xMin_) + ((Layout::dims == 3) ? 4 * (lo.z_ < root_->zMin_) : 0);
+		Instr::count(OctreeCounter::Allocations);
+		Node<Tname, Layout>* newRoot = new Node<Tname, Layout>();
+		newRoot->xMin_ = (octant & 2) ? root_->xMin_ - xLen : root_->xMin_; newRoot->xMax_ = newRoot->xMin_ + 2 * xLen;
+		newRoot->yMin_ = (octant & 1) ? root_->yMin_ - yLen : root_->yMin_; newRoot->yMax_ = newRoot->yMin_ + 2 * yLen;
+		newRoot->zMin_ = (octant & 4) ? root_->zMin_ - zLen : root_->zMin_; newRoot->zMax_ = newRoot->zMin_ + 2 * zLen;
+		newRoot->split_ = vec3{ (newRoot->xMax_ + newRoot->xMin_) / 2, (newRoot->yMax_ + newRoot->yMin_) / 2, (newRoot->zMax_ + newRoot->zMin_) / 2 };
+		newRoot->x_ = root_->x_; newRoot->y_ = root_->y_; newRoot->z_ = root_->z_;
+		newRoot->contMin_ = root_->contMin_; newRoot->contMax_ = root_->contMax_;
+		newRoot->num_ = root_->num_;
+		newRoot->depth_ = root_->depth_;
+		if (root_->num_ > 0 || root_->hasChildren()) {
+			root_->parent_ = newRoot;
+			newRoot->addChild(octant, root_);
+		}
+		else {
+			delete root_;
+		}
+		root_ = newRoot;
+		levels++;
+	}
+	if (levels > 0) {  // existing nodes sit deeper, and maxDepth_ follows so the finest cells keep their size
+		std::vector<Node<Tname, Layout>*> stack{ root_ };
+		while (!stack.empty()) {
+			Node<Tname, Layout>* node = stack.back(); stack.pop_back();
+			for (int i = 0; i < node->numChildren(); i++) {
+				node->child_[i]->depth_ = node->depth_ + 1;
+				stack.push_back(node->child_[i]);
+			}
+		}
+		maxDepth_ += levels;
+	}
+	return root_->contains(lo) && root_->contains(hi);
+}
+
+// Octree reorder functions
+template <typename Tname, typename Instr, typename Layout> std::vector<uint32_t> Octree<Tname, Instr, Layout>::getTreeOrder(Tname* ObjArr, int size, int numThreads) const {
+	// Rank nodes in depth first preorder, so leaf ranks follow the leaf order build() produced
+	std::unordered_map<const Node<Tname, Layout>*, uint32_t> rank;
+	std::vector<const Node<Tname, Layout>*> stack{ root_ };
+	while (!stack.empty()) {
+		const Node<Tname, Layout>* node = stack.back(); stack.pop_back();
+		rank.emplace(node, (uint32_t)rank.size());
+		for (int i = node->numChildren() - 1; i >= 0; i--) { stack.push_back(node->child_[i]); }  // reversed, so octant 0 is ranked first
+	}
+	// Key each object by the rank of the deepest node holding it, objects in an empty octant take the rank of its parent
+	uint32_t outside = (uint32_t)rank.size();  // out of bounds objects go last
+	std::vector<uint32_t> key(size);
+	parallelFor(size, numThreads, [&](int i) {
+		vec3 V = getCoords(ObjArr[i]);  // using function provided to get obj coords
+		key[i] = root_->contains(V) ? rank.find(descendToLeaf(root_, V))->second : outside;
+	});
+	// Counting sort on the keys, stable so objects sharing a leaf keep their relative order
+	std::vector<uint32_t> start(outside + 2, 0);
+	for (int i = 0; i < size; i++) { start[key[i] + 1]++; }
+	for (size_t k = 1; k < start.size(); k++) { start[k] += start[k - 1]; }
+	std::vector<uint32_t> order(size);
+	for (int i = 0; i < size; i++) { order[start[key[i]]++] = i; }
+	return order;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template<typename... Ts>
+void Octree<Tname, Instr, Layout>::reorder(Tname* ObjArr, int size, Ts*... arrays) const {  // the tree itself is unchanged, it holds its own objects
+	std::vector<uint32_t> order = getTreeOrder(ObjArr, size);
+	applyOrder(order, ObjArr);
+	(applyOrder(order, arrays), ...);
+}
+
+// Octree file functions
+template <typename Tname, typename Instr, typename Layout> int Octree<Tname, Instr, Layout>::flattenNode(const Node<Tname, Layout>* node, std::vector<OctreeFileNode>& nodes, uint64_t& objCounter) const {
+	int indx = (int)nodes.size();
+	nodes.emplace_back();
+	OctreeFileNode flat;
+	std::memset(&flat, 0, sizeof(flat));
+	flat.x_ = node->x_; flat.y_ = node->y_; flat.z_ = node->z_;
+	flat.xMax_ = node->xMax_; flat.xMin_ = node->xMin_; flat.yMax_ = node->yMax_; flat.yMin_ = node->yMin_; flat.zMax_ = node->zMax_; flat.zMin_ = node->zMin_;
+	flat.firstObj_ = objCounter;
+	flat.num_ = node->num_;
+	flat.depth_ = node->depth_;
+	flat.leaf_ = node->leaf_;
+	for (int i = 0; i < 8; i++) {
+		flat.child_[i] = -1;
+	}
+	if (node->hasChildren()) {
+		for (int i = 0; i < 8; i++) {  // absent children stay -1
+			if (node->getChild(i)) { flat.child_[i] = flattenNode(node->getChild(i), nodes, objCounter); }
+		}
+	}
+	else {
+		objCounter += node->num_;
+	}
+	nodes[indx] = flat;
+	return indx;
+}
+
+template <typename Tname, typename Instr, typename Layout> bool Octree<Tname, Instr, Layout>::writeNodeData(const Node<Tname, Layout>* node, FILE* file) const {
+	if (node->hasChildren()) {
+		for (int i = 0; i < node->numChildren(); i++) {
+			if (!writeNodeData(node->child_[i], file)) { return false; }
+		}
+		return true;
+	}
+	return node->num_ == 0 || fwrite(node->Objs_, sizeof(Tname), node->num_, file) == (size_t)node->num_;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template <triviallyCopyable>
+bool Octree<Tname, Instr, Layout>::writeFile(const char* path) const {
+	static_assert(Layout::dims == 3, "the file format and OctreeView test z at every node, so quadtrees can't be written");
+	std::vector<OctreeFileNode> nodes;
+	uint64_t numObjs = 0;
+	flattenNode(root_, nodes, numObjs);
+	OctreeFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic_, "ELLIEOCT", 8);
+	header.version_ = 1;
+	header.objSize_ = sizeof(Tname);
+	header.xMax_ = root_->xMax_; header.xMin_ = root_->xMin_; header.yMax_ = root_->yMax_; header.yMin_ = root_->yMin_; header.zMax_ = root_->zMax_; header.zMin_ = root_->zMin_;
+	header.maxDepth_ = maxDepth_; header.maxLeaf_ = maxLeaf_;
+	header.numNodes_ = nodes.size(); header.numObjs_ = numObjs; header.rootIndx_ = 0;
+	header.nodeOffset_ = (sizeof(header) + 63) / 64 * 64;  // keep the arrays cache line aligned
+	header.objOffset_ = (header.nodeOffset_ + nodes.size() * sizeof(OctreeFileNode) + 63) / 64 * 64;
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		std::cout << "Could not open " << path << " for writing." << std::endl;
+		return false;
+	}
+	static const char zeros[64] = {};
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(zeros, 1, header.nodeOffset_ - sizeof(header), file) == header.nodeOffset_ - sizeof(header);
+	ok = ok && fwrite(nodes.data(), sizeof(OctreeFileNode), nodes.size(), file) == nodes.size();
+	uint64_t pad = header.objOffset_ - header.nodeOffset_ - nodes.size() * sizeof(OctreeFileNode);
+	ok = ok && fwrite(zeros, 1, pad, file) == pad;
+	ok = ok && writeNodeData(root_, file);
+	ok = (fclose(file) == 0) && ok;
+	if (!ok) {
+		std::cout << "Failed writing octree to " << path << "." << std::endl;
+	}
+	return ok;
+}
+
+// Octree move/copy octree object functions
+template <typename Tname, typename Instr, typename Layout>
+template <moveable>
+Tname* Octree<Tname, Instr, Layout>::moveTreeData(Node<Tname, Layout>* node, Tname* ObjArr, bool) {
+	static_assert(Layout::parent, "moveTreeData() needs parent pointers");
+	clearNodeTable();
+	int counter = 0;  // array element counter
+	if (ObjArr == nullptr) { ObjArr = new Tname[node->num_](); }  // Create new array of size of node->num_
+	drainNode(node, ObjArr, counter);  // Move elements to array
+	node->clearChildren();
+	if (node->Objs_) { delete[] node->Objs_; }
+	node->Objs_ = nullptr;
+	node->num_ = 0;  // No objects in node now
+	node->leaf_ = false;
+	node->x_ = 0; node->y_ = 0; node->z_ = 0;
+	if (node->parent_) {
+		updateNode(node->parent_);  // Update its parent nodes
+	}
+	return ObjArr;  // return array of objects
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template <copyable>
+Tname* Octree<Tname, Instr, Layout>::copyTreeData(Node<Tname, Layout>* node, Tname* ObjArr, bool) const {
+	int counter = 0;  // array element counter (local, so concurrent readers don't share it)
+	if (ObjArr == nullptr) { ObjArr = new Tname[node->num_](); }  // Create new array of size of node->num_
+	copyNodeData(node, ObjArr, counter);
+	return ObjArr;  // return array of objects
+}
+
+template <typename Tname, typename Instr, typename Layout> void Octree<Tname, Instr, Layout>::copyNodeData(const Node<Tname, Layout>* node, Tname* ObjArr, int& counter) const {
+	if (node->hasChildren()) {
+		for (int i = 0; i < node->numChildren(); i++) {  // Iterating over the present child_ nodes
+			copyNodeData(node->child_[i], ObjArr, counter);  // repeat process with child_ nodes
+		}
+		return;
+	}
+	Instr::count(OctreeCounter::ObjCopies, node->num_);
+	for (int j = 0; j < node->num_; j++) {
+		ObjArr[counter] = node->Objs_[j];  // Copy over element to array
+		counter++;  // increase iterator
+	}
+}
+
+// Octree add to octree functions
+template <typename Tname, typename Instr, typename Layout>
+template<copyableOnly>
+void Octree<Tname, Instr, Layout>::addToTree(Tname Obj) {
+	static_assert(Layout::parent, "addToTree(Obj) needs parent pointers, use stage() and flush() with this node layout");
+	clearNodeTable();
+	vec3 coords = getCoords(Obj);  // using function provided to get obj coords
+	Node<Tname, Layout>* destNode = root_->contains(coords) ? makeLeaf(root_, coords) : nullptr;  // creates the leaf in an empty region
+	if (!destNode) {  // object is out of bounds. Call addToTree(Tname*).
+		Tname* ObjArr = new Tname[1]; ObjArr[0] = std::move(Obj);
+		addToTree(ObjArr, 1);  // rebuild tree
+	}
+	else {  // object is in bounds. Update destination node and parents
+		Instr::count(OctreeCounter::Allocations);
+		countTransfers(destNode->num_ + 1);
+		Tname* destObjs = new Tname[destNode->num_ + 1];
+		for (int k = 0; k < destNode->num_; k++) {
+			destObjs[k] = destNode->Objs_[k];
+		}
+		// Move object to leaf node, adjust array sizes appropriately
+		destObjs[destNode->num_] = Obj;
+		destNode->num_++;
+		if (destNode->Objs_ != nullptr) {
+			delete[] destNode->Objs_;
+		}
+		destNode->Objs_ = destObjs;
+		updateNode(destNode);  // Update destination node, building more leaves if needed, update extended family nodes
+	}
+	return;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template<moveable>
+void Octree<Tname, Instr, Layout>::addToTree(Tname Obj) {
+	static_assert(Layout::parent, "addToTree(Obj) needs parent pointers, use stage() and flush() with this node layout");
+	clearNodeTable();
+	vec3 coords = getCoords(Obj);  // using function provided to get obj coords
+	Node<Tname, Layout>* destNode = root_->contains(coords) ? makeLeaf(root_, coords) : nullptr;  // creates the leaf in an empty region
+	if (!destNode) {  // object is out of bounds. Call addToTree(Tname*).
+		Tname* ObjArr = new Tname[1]; ObjArr[0] = std::move(Obj);
+		addToTree(ObjArr, 1);  // rebuild tree
+	}
+	else {  // object is in bounds. Update destination node and parents
+		Instr::count(OctreeCounter::Allocations);
+		countTransfers(destNode->num_ + 1);
+		Tname* destObjs = new Tname[destNode->num_ + 1];
+		for (int k = 0; k < destNode->num_; k++) {
+			destObjs[k] = std::move(destNode->Objs_[k]);
+		}
+		// Move object to leaf node, adjust array sizes appropriately
+		destObjs[destNode->num_] = std::move(Obj);
+		destNode->num_++;
+		if (destNode->Objs_ != nullptr) {
+			delete[] destNode->Objs_;
+		}
+		destNode->Objs_ = destObjs;
+		updateNode(destNode);  // Update destination node, building more leaves if needed, update extended family nodes
+	}
+	return;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template<copyableOnly>
+void Octree<Tname, Instr, Layout>::addToTree(Tname* ObjArr, int size) {
+	rebuildWith(ObjArr, size);  // copies objects from ObjArr
+	return;
+}
+
+template <typename Tname, typename Instr, typename Layout>
+template<moveable>
+void Octree<Tname, Instr, Layout>::addToTree(Tname* ObjArr, int size) {
+	rebuildWith(ObjArr, size);  // moves objects from ObjArr
+	return;
+}
+
+
+template <copyable Tname, typename Instr = NoInstrumentation, typename Layout = FullNode>
+class DoubleBufferedOctree {  // Full octree copies for concurrent readers, published atomically by a single writer
+	// Each write clones the whole current tree, O(n) time and memory per publish, as nodes own their children and
+	// aren't shared between versions. Two trees are kept, plus one per older version a reader still pins
+private:
+	struct Version {
+		Octree<Tname, Instr, Layout>* tree_ = nullptr;
+		std::atomic<int> readers_{ 0 };  // readers pinning this version
+	};
+	std::atomic<Version*> current_;  // latest published version
+	Version* working_;  // version being written, not visible to readers
+	std::vector<Version*> versions_;  // all versions, only touched by the writer
+
+public:
+	class Snapshot {  // a pinned version, readable without locks until destroyed
+	private:
+		Version* version_;
+	public:
+		explicit Snapshot(Version* version) : version_(version) {}
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator = (const Snapshot&) = delete;
+		Snapshot(Snapshot&& S) : version_(S.version_) { S.version_ = nullptr; }
+		~Snapshot() { if (version_) { version_->readers_--; } }
+		const Octree<Tname, Instr, Layout>& operator*() const { return *version_->tree_; }
+		const Octree<Tname, Instr, Layout>* operator->() const { return version_->tree_; }
+	};
+
+	DoubleBufferedOctree(Tname* Objects, typename Octree<Tname, Instr, Layout>::objToCoord funcToPlace, int objArrSize, int maxDepth, int maxLeafSize, double xMin = 0, double xMax = 0, double yMin = 0, double yMax = 0, double zMin = 0, double zMax = 0);  // Constructor
+	~DoubleBufferedOctree();  // Destructor, no snapshots may be alive
+	DoubleBufferedOctree(const DoubleBufferedOctree<Tname, Instr, Layout>&) = delete;
+	DoubleBufferedOctree& operator = (const DoubleBufferedOctree<Tname, Instr, Layout>&) = delete;
+
+	// Reader functions
+	Snapshot pin() const;  // Pin the current version
+
+	// Writer functions
+	Octree<Tname, Instr, Layout>& beginWrite();  // Full copy of the current version for the writer to modify
+	void publish();  // Atomically make the written copy the current version
+	void reclaim();  // Free trees of old versions no reader has pinned
+};
+
+// DoubleBufferedOctree constructor/destructor
+template <copyable Tname, typename Instr, typename Layout> DoubleBufferedOctree<Tname, Instr, Layout>::DoubleBufferedOctree(Tname* Objects, typename Octree<Tname, Instr, Layout>::objToCoord funcToPlace, int objArrSize, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax) {
+	Version* first = new Version();
+	first->tree_ = new Octree<Tname, Instr, Layout>(Objects, funcToPlace, objArrSize, maxDepth, maxLeafSize, xMin, xMax, yMin, yMax, zMin, zMax);
+	versions_.push_back(first);
+	working_ = nullptr;
+	current_.store(first);
+}
+
+template <copyable Tname, typename Instr, typename Layout> DoubleBufferedOctree<Tname, Instr, Layout>::~DoubleBufferedOctree() {
+	for (Version* version : versions_) {
+		if (version->tree_) { delete version->tree_; }
+		delete version;
+	}
+}
+
+// DoubleBufferedOctree reader functions
+template <copyable Tname, typename Instr, typename Layout> typename DoubleBufferedOctree<Tname, Instr, Layout>::Snapshot DoubleBufferedOctree<Tname, Instr, Layout>::pin() const {
+	while (true) {  // announce the reader, then check the version is still current
+		Version* version = current_.load();
+		version->readers_++;
+		if (current_.load() == version) { return Snapshot(version); }
+		version->readers_--;  // a writer published in between, retry
+	}
+}
+
+// DoubleBufferedOctree writer functions
+template <copyable Tname, typename Instr, typename Layout> Octree<Tname, Instr, Layout>& DoubleBufferedOctree<Tname, Instr, Layout>::beginWrite() {
+	if (working_) { return *working_->tree_; }
+	Version* current = current_.load();
+	for (Version* version : versions_) {  // reuse a version no reader can reach
+		if (version != current && version->readers_.load() == 0) {
+			working_ = version;
+			break;
+		}
+	}
+	if (!working_) {
+		working_ = new Version();
+		versions_.push_back(working_);
+	}
+	if (!working_->tree_) { working_->tree_ = new Octree<Tname, Instr, Layout>(); }
+	working_->tree_->cloneFrom(*current->tree_);
+	return *working_->tree_;
+}
+
+template <copyable Tname, typename Instr, typename Layout> void DoubleBufferedOctree<Tname, Instr, Layout>::publish() {
+	if (!working_) { return; }
+	current_.store(working_);
+	working_ = nullptr;
+}
+
+template <copyable Tname, typename Instr, typename Layout> void DoubleBufferedOctree<Tname, Instr, Layout>::reclaim() {
+	Version* current = current_.load();
+	for (Version* version : versions_) {
+		// A reader arriving after this check sees the version is not current and backs off without touching the tree
+		if (version != current && version != working_ && version->readers_.load() == 0 && version->tree_) {
+			delete version->tree_;
+			version->tree_ = nullptr;
+		}
+	}
+}
+
+
+template <triviallyCopyable Tname>
+class OctreeView {  // read-only octree over a file written by Octree::writeFile, memory mapped where available
+private:
+	const char* data_;  // start of the file contents
+	size_t size_;  // file size in bytes
+	bool mapped_;  // data_ is a mapping rather than a heap copy
+	const OctreeFileHeader* header_;
+	const OctreeFileNode* nodes_;
+	const Tname* objs_;
+	bool mapFile(int fd, const char* path);  // Map an open descriptor and close it
+	bool checkHeader(const char* path);  // Validate the mapped contents and point into them
+
+public:
+	typedef vec3(*objToCoord)(Tname& Obj);  // Function pointer
+	objToCoord func;  // Function to convert an object to a coordinate
+
+	OctreeView(objToCoord funcToPlace = nullptr) : data_(nullptr), size_(0), mapped_(false), header_(nullptr), nodes_(nullptr), objs_(nullptr), func(funcToPlace) {}
+	~OctreeView() { close(); }  // Destructor
+	OctreeView(const OctreeView<Tname>&) = delete;
+	OctreeView& operator = (const OctreeView<Tname>&) = delete;
+
+	bool open(const char* path);  // Map a file, no deserialisation
+	bool openShared(const char* name);  // Map a POSIX shared memory object holding the same format, e.g. a ShardedOctree shard
+	void close();
+
+	// getter functions
+	const OctreeFileHeader* getHeader() const { return header_; }
+	const OctreeFileNode* getRoot() const { return nodes_ ? &nodes_[header_->rootIndx_] : nullptr; }
+	const OctreeFileNode* getChild(const OctreeFileNode* node, int i) const { return (node->child_[i] >= 0) ? &nodes_[node->child_[i]] : nullptr; }
+	const Tname* getNodeData(const OctreeFileNode* node) const { return objs_ + node->firstObj_; }  // objects of the whole subtree
+	int getMaxDepth() const { return header_->maxDepth_; }
+	int getMaxLeaf() const { return header_->maxLeaf_; }
+
+	// Member functions
+	const OctreeFileNode* findLeafNode(const double X, const double Y, const double Z) const;  // Returns a Leaf Node at position (x, y, z), nullptr if out of bounds or in an empty region
+	template<typename F> void rangeQuery(double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, F&& visit) const;  // visit(const Tname&) for objects in the box
+};
+
+template <triviallyCopyable Tname> bool OctreeView<Tname>::open(const char* path) {
+	close();
+#ifdef OCTREE_MMAP
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		std::cout << "Could not open " << path << "." << std::endl;
+		return false;
+	}
+	if (!mapFile(fd, path)) { return false; }
+#else
+	FILE* file = fopen(path, "rb");  // no mmap, read the file into memory instead
+	if (!file) {
+		std::cout << "Could not open " << path << "." << std::endl;
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	size_ = (size_t)ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char* buffer = new char[size_];
+	bool ok = fread(buffer, 1, size_, file) == size_;
+	fclose(file);
+	data_ = buffer;
+	if (!ok) {
+		close();
+		std::cout << "Could not read " << path << "." << std::endl;
+		return false;
+	}
+#endif
+	return checkHeader(path);
+}
+
+template <triviallyCopyable Tname> bool OctreeView<Tname>::openShared(const char* name) {
+	close();
+#ifdef OCTREE_MMAP
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		std::cout << "Could not open shared memory " << name << "." << std::endl;
+		return false;
+	}
+	return mapFile(fd, name) && checkHeader(name);
+#else
+	std::cout << "Shared memory views need POSIX mmap." << std::endl;
+	return false;
+#endif
+}
+
+template <triviallyCopyable Tname> bool OctreeView<Tname>::mapFile(int fd, const char* path) {
+#ifdef OCTREE_MMAP
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(OctreeFileHeader)) {
+		::close(fd);
+		std::cout << path << " is not an octree file." << std::endl;
+		return false;
+	}
+	size_ = (size_t)info.st_size;
+	void* map = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);  // the mapping stays valid
+	if (map == MAP_FAILED) {
+		std::cout << "Could not map " << path << "." << std::endl;
+		return false;
+	}
+	data_ = (const char*)map;
+	mapped_ = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+template <triviallyCopyable Tname> bool OctreeView<Tname>::checkHeader(const char* path) {
+	header_ = (const OctreeFileHeader*)data_;
+	if (size_ < sizeof(OctreeFileHeader) || std::memcmp(header_->magic_, "ELLIEOCT", 8) != 0 || header_->version_ != 1 || header_->objSize_ != sizeof(Tname)
+		|| header_->objOffset_ + header_->numObjs_ * sizeof(Tname) > size_ || header_->numNodes_ == 0 || header_->rootIndx_ >= header_->numNodes_
+		|| header_->nodeOffset_ + header_->numNodes_ * sizeof(OctreeFileNode) > size_) {
+		close();
+		std::cout << path << " is not an octree file for this object type." << std::endl;
+		return false;
+	}
+	nodes_ = (const OctreeFileNode*)(data_ + header_->nodeOffset_);
+	objs_ = (const Tname*)(data_ + header_->objOffset_);
+	return true;
+}
+
+template <triviallyCopyable Tname> void OctreeView<Tname>::close() {
+	if (data_) {
+#ifdef OCTREE_MMAP
+		if (mapped_) { munmap((void*)data_, size_); }
+#else
+		delete[] data_;
+#endif
+	}
+	data_ = nullptr; size_ = 0; mapped_ = false;
+	header_ = nullptr; nodes_ = nullptr; objs_ = nullptr;
+}
+
+template <triviallyCopyable Tname> const OctreeFileNode* OctreeView<Tname>::findLeafNode(const double X, const double Y, const double Z) const {
+	const OctreeFileNode* node = getRoot();
+	if (!node || X > node->xMax_ || X < node->xMin_ || Y > node->yMax_ || Y < node->yMin_ || Z > node->zMax_ || Z < node->zMin_) {
+		return nullptr; // Coordinates are out of bounds of the octree, return nullptr
+	}
+	while (node->hasChildren()) {  // while not at a leaf or empty node
+		int first = 0;
+		while (node->child_[first] < 0) { first++; }
+		const OctreeFileNode* child = &nodes_[node->child_[first]];  // any present child's bounds give the split planes, which need not be midpoints
+		double xSplit = (first & 2) ? child->xMin_ : child->xMax_;
+		double ySplit = (first & 1) ? child->yMin_ : child->yMax_;
+		double zSplit = (first & 4) ? child->zMin_ : child->zMax_;
+		int octant = (Y > ySplit) + 2 * (X > xSplit) + 4 * (Z > zSplit);
+		if (node->child_[octant] < 0) { return nullptr; }  // absent child_, the region holds no objects
+		node = &nodes_[node->child_[octant]];
+	}
+	return node;
+}
+
+template <triviallyCopyable Tname>
+template <typename F>
+void OctreeView<Tname>::rangeQuery(double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, F&& visit) const {
+	if (!getRoot()) { return; }
+	std::vector<const OctreeFileNode*> stack{ getRoot() };
+	while (!stack.empty()) {
+		const OctreeFileNode* node = stack.back(); stack.pop_back();
+		if (node->num_ == 0 || node->xMin_ > xMax || node->xMax_ < xMin || node->yMin_ > yMax || node->yMax_ < yMin || node->zMin_ > zMax || node->zMax_ < zMin) {
+			continue;  // empty or disjoint
+		}
+		const Tname* objs = objs_ + node->firstObj_;
+		if (node->xMin_ >= xMin && node->xMax_ <= xMax && node->yMin_ >= yMin && node->yMax_ <= yMax && node->zMin_ >= zMin && node->zMax_ <= zMax) {
+			for (int j = 0; j < node->num_; j++) { visit(objs[j]); }  // node inside the box, emit its whole subtree
+		}
+		else if (node->hasChildren()) {
+			for (int i = 0; i < 8; i++) {
+				if (node->child_[i] >= 0) { stack.push_back(&nodes_[node->child_[i]]); }
+			}
+		}
+		else {  // partially overlapping leaf, test each object
+			for (int j = 0; j < node->num_; j++) {
+				Tname obj = objs[j];  // local copy, func takes a mutable reference and the pages are read-only
+				vec3 V = func(obj);
+				if (V.x_ >= xMin && V.x_ <= xMax && V.y_ >= yMin && V.y_ <= yMax && V.z_ >= zMin && V.z_ <= zMax) { visit(objs[j]); }
+			}
+		}
+	}
+}
+
+
+template <triviallyCopyable Tname>
+class OctreeStreamBuilder {  // out-of-core builder writing the OctreeView file format with bounded memory
+private:
+	int maxDepth_, maxLeaf_;  // maximum tree depth and leaf amount
+	int prefixLevels_;  // levels of the shared top tree, giving 8^prefixLevels_ buckets
+	int chunkSize_;  // objects read per reader call
+	double xMax_, xMin_, yMax_, yMin_, zMax_, zMin_;  // root bounds, fixed up front
+	uint64_t dropped_;  // objects outside the root bounds
+	bool keepTop_;  // top tree nodes stay internal down to the buckets, so each bucket's subtree is found by its octant path
+
+	struct Summary {  // what a parent needs from a written subtree
+		int32_t indx_;  // node index in the file
+		int32_t num_;
+		double x_, y_, z_;  // c.o.d. values
+		uint64_t firstObj_;
+	};
+	static void splitCell(OctreeFileNode& cell, int octant);  // Shrink cell bounds to a child_ octant
+	OctreeFileNode getRootCell() const;
+	int getBucket(const vec3& V) const;  // Top tree cell of a position, in depth first order
+	Summary writeBucket(Tname* Objects, int size, const OctreeFileNode& cell, FILE* nodeFile, FILE* objFile, int& numNodes, uint64_t& numObjs, bool& ok);  // ok is cleared on a failed write
+	Summary makeTopNode(int level, int& bucket, const OctreeFileNode& cell, const std::vector<Summary>& buckets, std::vector<OctreeFileNode>& topNodes, int nodeBase) const;
+	template<typename Loader> bool writeTree(Loader&& load, FILE* out);  // Build every bucket and stitch the file, load(bucket, std::vector<Tname>&) fills a bucket's objects
+	template <triviallyCopyable T> friend class ShardedOctree;
+
+public:
+	typedef vec3(*objToCoord)(Tname& Obj);  // Function pointer
+	objToCoord func;  // Function to convert an object to a coordinate
+
+	OctreeStreamBuilder(objToCoord funcToPlace, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, int prefixLevels = 2, int chunkSize = 65536);  // Constructor, prefixLevels is capped at 3
+
+	// Member functions
+	template<typename Reader> bool build(Reader&& read, const char* outPath);  // read(Tname* buffer, int capacity) returns objects read, 0 at the end
+	bool buildFromFile(const char* inPath, const char* outPath);  // Input is a raw array of Tname
+	uint64_t getDropped() const { return dropped_; }
+};
+
+// OctreeStreamBuilder constructor
+template <triviallyCopyable Tname> OctreeStreamBuilder<Tname>::OctreeStreamBuilder(objToCoord funcToPlace, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, int prefixLevels, int chunkSize) {
+	func = funcToPlace;
+	maxDepth_ = maxDepth; maxLeaf_ = maxLeafSize;
+	// build() keeps one spill file per bucket open at once, 8^prefixLevels_ of them, so the cap of 3 needs 512 free file descriptors plus the output and node files
+	// bucket roots sit at depth prefixLevels_ - 1
+	prefixLevels_ = std::clamp(prefixLevels, 1, std::max(1, std::min(3, maxDepth + 1)));
+	chunkSize_ = std::max(1, chunkSize);
+	xMax_ = xMax; xMin_ = xMin; yMax_ = yMax; yMin_ = yMin; zMax_ = zMax; zMin_ = zMin;
+	dropped_ = 0;
+	keepTop_ = false;
+}
+
+// OctreeStreamBuilder cell functions
+template <triviallyCopyable Tname> void OctreeStreamBuilder<Tname>::splitCell(OctreeFileNode& cell, int octant) {
+	double xCent = (cell.xMax_ + cell.xMin_) / 2, yCent = (cell.yMax_ + cell.yMin_) / 2, zCent = (cell.zMax_ + cell.zMin_) / 2;
+	if (octant & 1) { cell.yMin_ = yCent; } else { cell.yMax_ = yCent; }
+	if (octant & 2) { cell.xMin_ = xCent; } else { cell.xMax_ = xCent; }
+	if (octant & 4) { cell.zMin_ = zCent; } else { cell.zMax_ = zCent; }
+}
+
+template <triviallyCopyable Tname> OctreeFileNode OctreeStreamBuilder<Tname>::getRootCell() const {
+	OctreeFileNode cell;
+	std::memset(&cell, 0, sizeof(cell));
+	cell.xMax_ = xMax_; cell.xMin_ = xMin_; cell.yMax_ = yMax_; cell.yMin_ = yMin_; cell.zMax_ = zMax_; cell.zMin_ = zMin_;
+	for (int i = 0; i < 8; i++) { cell.child_[i] = -1; }
+	return cell;
+}
+
+template <triviallyCopyable Tname> int OctreeStreamBuilder<Tname>::getBucket(const vec3& V) const {
+	OctreeFileNode cell = getRootCell();
+	int bucket = 0;
+	for (int level = 0; level < prefixLevels_; level++) {  // descend as build() would split
+		int octant = (V.y_ > (cell.yMax_ + cell.yMin_) / 2) + 2 * (V.x_ > (cell.xMax_ + cell.xMin_) / 2) + 4 * (V.z_ > (cell.zMax_ + cell.zMin_) / 2);
+		splitCell(cell, octant);
+		bucket = bucket * 8 + octant;
+	}
+	return bucket;
+}
+
+// OctreeStreamBuilder build functions
+template <triviallyCopyable Tname>
+typename OctreeStreamBuilder<Tname>::Summary OctreeStreamBuilder<Tname>::writeBucket(Tname* Objects, int size, const OctreeFileNode& cell, FILE* nodeFile, FILE* objFile, int& numNodes, uint64_t& numObjs, bool& ok) {
+	Summary summary{ numNodes, size, 0, 0, 0, numObjs };
+	std::vector<OctreeFileNode> nodes;
+	if (size > maxLeaf_ && prefixLevels_ - 1 != maxDepth_) {  // build the bucket's subtree in memory
+		Octree<Tname> subtree(Objects, func, size, maxDepth_ - prefixLevels_, maxLeaf_, cell.xMin_, cell.xMax_, cell.yMin_, cell.yMax_, cell.zMin_, cell.zMax_);
+		uint64_t objCounter = 0;
+		subtree.flattenNode(subtree.getRoot(), nodes, objCounter);
+		ok = subtree.writeNodeData(subtree.getRoot(), objFile) && ok;
+		for (OctreeFileNode& node : nodes) {  // shift to file-wide indices and depths
+			node.firstObj_ += numObjs;
+			node.depth_ += prefixLevels_;
+			for (int i = 0; i < 8; i++) {
+				if (node.child_[i] >= 0) { node.child_[i] += numNodes; }
+			}
+		}
+		summary.x_ = nodes[0].x_; summary.y_ = nodes[0].y_; summary.z_ = nodes[0].z_;
+	}
+	else {  // the bucket is a leaf or an empty node
+		OctreeFileNode leaf = cell;
+		for (int j = 0; j < size; j++) {
+			vec3 V = func(Objects[j]);
+			leaf.x_ += V.x_; leaf.y_ += V.y_; leaf.z_ += V.z_;
+		}
+		if (size > 0) {
+			leaf.x_ /= size; leaf.y_ /= size; leaf.z_ /= size;
+			ok = fwrite(Objects, sizeof(Tname), size, objFile) == (size_t)size && ok;
+		}
+		leaf.num_ = size;
+		leaf.depth_ = prefixLevels_ - 1;
+		leaf.leaf_ = size > 0;
+		leaf.firstObj_ = numObjs;
+		nodes.push_back(leaf);
+		summary.x_ = leaf.x_; summary.y_ = leaf.y_; summary.z_ = leaf.z_;
+	}
+	ok = fwrite(nodes.data(), sizeof(OctreeFileNode), nodes.size(), nodeFile) == nodes.size() && ok;
+	numNodes += (int)nodes.size();
+	numObjs += size;
+	return summary;
+}
+
+template <triviallyCopyable Tname>
+typename OctreeStreamBuilder<Tname>::Summary OctreeStreamBuilder<Tname>::makeTopNode(int level, int& bucket, const OctreeFileNode& cell, const std::vector<Summary>& buckets, std::vector<OctreeFileNode>& topNodes, int nodeBase) const {
+	if (level == prefixLevels_) {  // buckets are visited in depth first order
+		return buckets[bucket++];
+	}
+	OctreeFileNode node = cell;
+	Summary summary{ 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 8; i++) {
+		OctreeFileNode childCell = cell;
+		splitCell(childCell, i);
+		Summary child = makeTopNode(level + 1, bucket, childCell, buckets, topNodes, nodeBase);
+		if (i == 0) { summary.firstObj_ = child.firstObj_; }  // subtree objects are contiguous
+		node.child_[i] = (child.num_ > 0) ? child.indx_ : -1;  // empty buckets are left out of the tree
+		summary.num_ += child.num_;
+		summary.x_ += child.x_ * child.num_; summary.y_ += child.y_ * child.num_; summary.z_ += child.z_ * child.num_;
+	}
+	if (summary.num_ > 0) {
+		summary.x_ /= summary.num_; summary.y_ /= summary.num_; summary.z_ /= summary.num_;
+	}
+	node.x_ = summary.x_; node.y_ = summary.y_; node.z_ = summary.z_;
+	node.num_ = summary.num_;
+	node.firstObj_ = summary.firstObj_;
+	node.depth_ = level - 1;
+	if (!keepTop_ && summary.num_ <= maxLeaf_) {  // too few objects to split, so the node is a leaf over its contiguous objects
+		for (int i = 0; i < 8; i++) { node.child_[i] = -1; }
+		node.leaf_ = summary.num_ > 0;
+	}
+	summary.indx_ = nodeBase + (int)topNodes.size();
+	topNodes.push_back(node);
+	return summary;
+}
+
+template <triviallyCopyable Tname>
+template <typename Reader>
+bool OctreeStreamBuilder<Tname>::build(Reader&& read, const char* outPath) {
+	// Pass 1: bucket objects by their top tree cell into spill files
+	int numBuckets = 1 << (3 * prefixLevels_);
+	const int spillBatch = 4096;  // objects buffered per bucket before spilling
+	std::vector<FILE*> spills(numBuckets);
+	std::vector<std::vector<Tname>> pending(numBuckets);
+	for (int b = 0; b < numBuckets; b++) {
+		spills[b] = tmpfile();
+		if (!spills[b]) {
+			for (int c = 0; c < b; c++) { fclose(spills[c]); }
+			std::cout << "Could not create spill files, " << numBuckets << " must be open at once." << std::endl;
+			return false;
+		}
+	}
+	Node<Tname> bounds;
+	bounds.xMax_ = xMax_; bounds.xMin_ = xMin_; bounds.yMax_ = yMax_; bounds.yMin_ = yMin_; bounds.zMax_ = zMax_; bounds.zMin_ = zMin_;
+	dropped_ = 0;
+	bool ok = true;
+	Tname* buffer = new Tname[chunkSize_];
+	for (int count = read(buffer, chunkSize_); count > 0; count = read(buffer, chunkSize_)) {
+		for (int i = 0; i < count; i++) {
+			vec3 V = func(buffer[i]);
+			if (!bounds.contains(V)) {
+				dropped_++;
+				continue;
+			}
+			int b = getBucket(V);
+			pending[b].push_back(buffer[i]);
+			if ((int)pending[b].size() == spillBatch) {
+				ok = fwrite(pending[b].data(), sizeof(Tname), pending[b].size(), spills[b]) == pending[b].size() && ok;
+				pending[b].clear();
+			}
+		}
+	}
+	delete[] buffer;
+	for (int b = 0; b < numBuckets; b++) {
+		ok = fwrite(pending[b].data(), sizeof(Tname), pending[b].size(), spills[b]) == pending[b].size() && ok;
+		std::vector<Tname>().swap(pending[b]);
+	}
+	if (!ok) {
+		for (FILE* spill : spills) { fclose(spill); }
+		std::cout << "Failed writing spill files." << std::endl;
+		return false;
+	}
+	if (dropped_ > 0) {
+		std::cout << dropped_ << " objects were outside the octree bounds and were dropped." << std::endl;
+	}
+
+	// Pass 2: build each bucket's subtree alone, loading one bucket at a time
+	FILE* out = fopen(outPath, "wb+");
+	if (!out) {
+		for (FILE* spill : spills) { fclose(spill); }
+		std::cout << "Could not open " << outPath << " for writing." << std::endl;
+		return false;
+	}
+	bool readOk = true;
+	ok = writeTree([&spills, &readOk](int b, std::vector<Tname>& objs) {
+		fseek(spills[b], 0, SEEK_END);
+		objs.resize(ftell(spills[b]) / sizeof(Tname));
+		rewind(spills[b]);
+		if (!objs.empty() && fread(objs.data(), sizeof(Tname), objs.size(), spills[b]) != objs.size()) {
+			objs.clear();
+			readOk = false;
+		}
+		fclose(spills[b]);
+	}, out);
+	ok = (fclose(out) == 0) && ok && readOk;
+	if (!ok) {
+		std::cout << "Failed writing octree to " << outPath << "." << std::endl;
+	}
+	return ok;
+}
+
+template <triviallyCopyable Tname>
+template <typename Loader>
+bool OctreeStreamBuilder<Tname>::writeTree(Loader&& load, FILE* out) {
+	// Objects go straight to the output and nodes to a spill file
+	FILE* nodeFile = tmpfile();
+	if (!nodeFile) {
+		std::cout << "Could not create a node spill file." << std::endl;
+		return false;
+	}
+	OctreeFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.objOffset_ = (sizeof(header) + 63) / 64 * 64;  // objects come first, the node array is appended at the end
+	fseek(out, (long)header.objOffset_, SEEK_SET);
+	int numBuckets = 1 << (3 * prefixLevels_);
+	std::vector<Summary> buckets(numBuckets);
+	std::vector<Tname> objs;  // the only objects held in memory at a time
+	int numNodes = 0;
+	uint64_t numObjs = 0;
+	bool ok = true;
+	for (int b = 0; b < numBuckets; b++) {
+		OctreeFileNode cell = getRootCell();
+		for (int level = 0; level < prefixLevels_; level++) {
+			splitCell(cell, (b >> (3 * (prefixLevels_ - 1 - level))) & 7);
+		}
+		load(b, objs);
+		buckets[b] = writeBucket(objs.data(), (int)objs.size(), cell, nodeFile, out, numNodes, numObjs, ok);
+		std::vector<Tname>().swap(objs);
+	}
+
+	// Stitch the buckets under the shared top tree
+	std::vector<OctreeFileNode> topNodes;
+	int bucket = 0;
+	Summary top = makeTopNode(0, bucket, getRootCell(), buckets, topNodes, numNodes);
+	ok = fwrite(topNodes.data(), sizeof(OctreeFileNode), topNodes.size(), nodeFile) == topNodes.size() && ok;
+	numNodes += (int)topNodes.size();
+
+	// Append the node array and write the header
+	static const char zeros[64] = {};
+	uint64_t objEnd = header.objOffset_ + numObjs * sizeof(Tname);
+	header.nodeOffset_ = (objEnd + 63) / 64 * 64;
+	ok = fwrite(zeros, 1, header.nodeOffset_ - objEnd, out) == header.nodeOffset_ - objEnd && ok;
+	rewind(nodeFile);
+	std::vector<OctreeFileNode> block(4096);
+	for (size_t got = fread(block.data(), sizeof(OctreeFileNode), block.size(), nodeFile); got > 0; got = fread(block.data(), sizeof(OctreeFileNode), block.size(), nodeFile)) {
+		ok = fwrite(block.data(), sizeof(OctreeFileNode), got, out) == got && ok;
+	}
+	ok = !ferror(nodeFile) && ok;
+	fclose(nodeFile);
+	std::memcpy(header.magic_, "ELLIEOCT", 8);
+	header.version_ = 1;
+	header.objSize_ = sizeof(Tname);
+	header.xMax_ = xMax_; header.xMin_ = xMin_; header.yMax_ = yMax_; header.yMin_ = yMin_; header.zMax_ = zMax_; header.zMin_ = zMin_;
+	header.maxDepth_ = maxDepth_; header.maxLeaf_ = maxLeaf_;
+	header.numNodes_ = numNodes; header.numObjs_ = numObjs; header.rootIndx_ = top.indx_;
+	rewind(out);
+	return ok && fwrite(&header, sizeof(header), 1, out) == 1 && fflush(out) == 0;
+}
+
+template <triviallyCopyable Tname> bool OctreeStreamBuilder<Tname>::buildFromFile(const char* inPath, const char* outPath) {
+	FILE* in = fopen(inPath, "rb");
+	if (!in) {
+		std::cout << "Could not open " << inPath << "." << std::endl;
+		return false;
+	}
+	bool ok = build([in](Tname* buffer, int capacity) { return (int)fread(buffer, sizeof(Tname), capacity, in); }, outPath);
+	fclose(in);
+	return ok;
+}
+
+template <triviallyCopyable Tname>
+class ShardedOctree {  // domain decomposition over Morton ranges of top tree cells, each shard built by a worker process into shared memory
+private:
+	OctreeStreamBuilder<Tname> writer_;  // bucketing and the shard format, with the top tree kept internal down to the buckets
+	int numShards_;
+	int numBuckets_;  // bottom cells of the top tree, the units moved between shards
+	double tolerance_;  // largest shard size over the mean that build() keeps without moving ranges
+	std::string prefix_;  // shared memory name prefix
+	int generation_;  // bumped per round of workers, so old and new shards coexist while ranges move
+	uint64_t dropped_;  // objects outside the root bounds
+	std::vector<int> rangeStart_;  // first bucket of each shard, shard s owns buckets [rangeStart_[s], rangeStart_[s + 1])
+	std::vector<uint64_t> bucketCounts_;  // objects per bucket
+	std::vector<vec3> bucketSums_;  // coordinate sums per bucket, for the top tree c.o.d.
+	std::vector<OctreeFileNode> top_;  // replicated top tree, level l starts at (8^l - 1) / 7 and its last level is the buckets
+	std::vector<OctreeView<Tname>*> shards_;  // mapped shards, nullptr before the first build
+	std::vector<std::string> names_;  // shared memory object of each shard
+
+	static int topIndx(int level, int cell) { return ((1 << (3 * level)) - 1) / 7 + cell; }
+	static int getOwner(int bucket, const std::vector<int>& ranges) { return (int)(std::upper_bound(ranges.begin(), ranges.end(), bucket) - ranges.begin()) - 1; }
+	const OctreeFileNode* bucketNode(const OctreeView<Tname>& shard, int bucket) const;  // Subtree of a bucket in a shard, nullptr if empty
+	void planRanges();  // Split the buckets into contiguous ranges minimising the largest shard
+	void makeTop();  // Aggregate the bucket counts into the top tree
+	template<typename Loader> bool buildShards(const std::vector<int>& which, Loader&& load);  // One worker process per shard, load(bucket, objs) fills a bucket's objects
+
+public:
+	typedef vec3(*objToCoord)(Tname& Obj);  // Function pointer
+
+	ShardedOctree(objToCoord funcToPlace, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, int numShards, int prefixLevels = 3, const char* name = "/ellieoctree", double tolerance = 0.1);  // Constructor
+	~ShardedOctree() { close(); }  // Destructor, unlinks the shards
+	ShardedOctree(const ShardedOctree<Tname>&) = delete;
+	ShardedOctree& operator = (const ShardedOctree<Tname>&) = delete;
+
+	// setter/getter functions
+	void setTolerance(double tolerance) { tolerance_ = tolerance; }
+	int getNumShards() const { return numShards_; }
+	const OctreeView<Tname>& getShard(int s) const { return *shards_[s]; }
+	const char* getShardName(int s) const { return names_[s].c_str(); }  // for other processes to openShared()
+	int getRangeStart(int s) const { return rangeStart_[s]; }  // first bucket of a shard, buckets are in Morton order
+	uint64_t getShardSize(int s) const;
+	double getImbalance() const;  // largest shard size over the mean
+	const OctreeFileNode* getRoot() const { return &top_[0]; }  // top tree root, children index into the top tree down to the buckets
+	uint64_t getDropped() const { return dropped_; }
+
+	// Member functions
+	bool build(Tname* Objects, int size);  // Bucket the objects, move ranges if unbalanced, and build each shard in its own worker process, forked so no other thread may be running
+	bool rebalance();  // Even out the ranges, rebuilding only the shards whose ranges changed from the existing shards, forks as build() does
+	void close();  // Unmap and unlink every shard
+	int findShard(const double X, const double Y, const double Z) const;  // Shard owning a position, -1 if out of bounds
+	const OctreeFileNode* findLeafNode(const double X, const double Y, const double Z) const;  // Leaf in the owning shard, nullptr if out of bounds or in an empty region
+	template<typename F> void rangeQuery(double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, F&& visit) const;  // visit(const Tname&), searching only shards whose buckets meet the box
+	template<typename F> void walk(F&& visit) const;  // Depth first walk, visit(const OctreeFileNode&, const Tname* objs) returns whether to open the node
+};
+
+// ShardedOctree constructor
+template <triviallyCopyable Tname> ShardedOctree<Tname>::ShardedOctree(objToCoord funcToPlace, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, int numShards, int prefixLevels, const char* name, double tolerance)
+	: writer_(funcToPlace, maxDepth, maxLeafSize, xMin, xMax, yMin, yMax, zMin, zMax, prefixLevels) {
+	writer_.keepTop_ = true;
+	numShards_ = std::max(1, numShards);
+	numBuckets_ = 1 << (3 * writer_.prefixLevels_);
+	tolerance_ = tolerance;
+	prefix_ = name;
+	generation_ = 0;
+	dropped_ = 0;
+	bucketCounts_.assign(numBuckets_, 0);
+	bucketSums_.assign(numBuckets_, vec3{ 0, 0, 0 });
+	shards_.assign(numShards_, nullptr);
+	names_.assign(numShards_, "");
+	planRanges();
+	makeTop();
+}
+
+// ShardedOctree range functions
+template <triviallyCopyable Tname> void ShardedOctree<Tname>::planRanges() {
+	// Binary search the smallest largest shard that contiguous ranges can reach, a bucket too full for any cut lands whole in one shard
+	uint64_t lo = 0, hi = 0;
+	for (int b = 0; b < numBuckets_; b++) {
+		lo = std::max(lo, bucketCounts_[b]);
+		hi += bucketCounts_[b];
+	}
+	auto fits = [this](uint64_t limit) {  // greedy fill, each shard takes buckets until the next would pass limit
+		int shards = 1;
+		uint64_t load = 0;
+		for (int b = 0; b < numBuckets_; b++) {
+			if (load + bucketCounts_[b] > limit) { shards++; load = 0; }
+			load += bucketCounts_[b];
+		}
+		return shards <= numShards_;
+	};
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (fits(mid)) { hi = mid; }
+		else { lo = mid + 1; }
+	}
+	rangeStart_.assign(numShards_ + 1, numBuckets_);
+	rangeStart_[0] = 0;
+	uint64_t load = 0;
+	int s = 1;
+	for (int b = 0; b < numBuckets_ && s < numShards_; b++) {  // start shard s where the limit is reached, or where each remaining shard gets just one bucket
+		if (b > rangeStart_[s - 1] && (load + bucketCounts_[b] > lo || numBuckets_ - b == numShards_ - s)) {
+			rangeStart_[s++] = b;
+			load = 0;
+		}
+		load += bucketCounts_[b];
+	}
+}
+
+template <triviallyCopyable Tname> uint64_t ShardedOctree<Tname>::getShardSize(int s) const {
+	uint64_t size = 0;
+	for (int b = rangeStart_[s]; b < rangeStart_[s + 1]; b++) {
+		size += bucketCounts_[b];
+	}
+	return size;
+}
+
+template <triviallyCopyable Tname> double ShardedOctree<Tname>::getImbalance() const {
+	uint64_t total = 0, largest = 0;
+	for (int s = 0; s < numShards_; s++) {
+		uint64_t size = getShardSize(s);
+		total += size;
+		largest = std::max(largest, size);
+	}
+	return (total > 0) ? (double)largest * numShards_ / total : 1;
+}
+
+template <triviallyCopyable Tname> void ShardedOctree<Tname>::makeTop() {
+	int levels = writer_.prefixLevels_;
+	top_.assign(topIndx(levels + 1, 0), writer_.getRootCell());
+	top_[0].depth_ = -1;
+	for (int level = 1; level <= levels; level++) {  // cells are halved top down, before any counts are set
+		for (int cell = 0; cell < (1 << (3 * level)); cell++) {
+			OctreeFileNode& node = top_[topIndx(level, cell)];
+			node = top_[topIndx(level - 1, cell >> 3)];
+			writer_.splitCell(node, cell & 7);
+			node.depth_ = level - 1;
+		}
+	}
+	for (int b = 0; b < numBuckets_; b++) {
+		OctreeFileNode& node = top_[topIndx(levels, b)];
+		node.num_ = (int32_t)bucketCounts_[b];
+		if (node.num_ > 0) {
+			node.x_ = bucketSums_[b].x_ / node.num_; node.y_ = bucketSums_[b].y_ / node.num_; node.z_ = bucketSums_[b].z_ / node.num_;
+		}
+	}
+	for (int level = levels - 1; level >= 0; level--) {  // then summed bottom up
+		for (int cell = 0; cell < (1 << (3 * level)); cell++) {
+			OctreeFileNode& node = top_[topIndx(level, cell)];
+			for (int i = 0; i < 8; i++) {
+				const OctreeFileNode& child = top_[topIndx(level + 1, cell * 8 + i)];
+				if (child.num_ == 0) { continue; }
+				node.child_[i] = topIndx(level + 1, cell * 8 + i);
+				node.x_ += child.x_ * child.num_; node.y_ += child.y_ * child.num_; node.z_ += child.z_ * child.num_;
+				node.num_ += child.num_;
+			}
+			if (node.num_ > 0) {
+				node.x_ /= node.num_; node.y_ /= node.num_; node.z_ /= node.num_;
+			}
+		}
+	}
+}
+
+template <triviallyCopyable Tname> const OctreeFileNode* ShardedOctree<Tname>::bucketNode(const OctreeView<Tname>& shard, int bucket) const {
+	int levels = writer_.prefixLevels_;
+	const OctreeFileNode* node = shard.getRoot();
+	for (int level = 0; node && level < levels; level++) {  // the shard's top nodes are never collapsed into leaves
+		node = shard.getChild(node, (bucket >> (3 * (levels - 1 - level))) & 7);
+	}
+	return node;
+}
+
+// ShardedOctree build functions
+template <triviallyCopyable Tname>
+template <typename Loader>
+bool ShardedOctree<Tname>::buildShards(const std::vector<int>& which, Loader&& load) {
+#ifdef OCTREE_MMAP
+	generation_++;
+	std::vector<pid_t> workers(which.size(), -1);
+	std::vector<std::string> names(which.size());
+	// fork() copies only the calling thread, so a lock held by another thread (the heap's, a stream's) stays locked in the worker, which allocates and writes
+	// no other thread may be running while the workers are forked
+	std::cout.flush();  // workers inherit unwritten output otherwise
+	fflush(stdout);
+	for (size_t k = 0; k < which.size(); k++) {
+		int s = which[k];
+		names[k] = prefix_ + "." + std::to_string(getpid()) + "." + std::to_string(s) + "." + std::to_string(generation_);
+		workers[k] = fork();
+		if (workers[k] == 0) {  // worker, builds its range into shared memory and exits without running the parent's destructors
+			int fd = shm_open(names[k].c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+			FILE* out = (fd >= 0) ? fdopen(fd, "wb+") : nullptr;
+			bool ok = out && writer_.writeTree([&](int b, std::vector<Tname>& objs) {  // false on any failed write, which fails the worker
+				if (b >= rangeStart_[s] && b < rangeStart_[s + 1]) { load(b, objs); }
+				else { objs.clear(); }
+			}, out);
+			ok = out && (fclose(out) == 0) && ok;
+			_exit(ok ? 0 : 1);
+		}
+	}
+	bool ok = true;
+	for (size_t k = 0; k < which.size(); k++) {
+		int status = 0;
+		ok = (workers[k] > 0) && waitpid(workers[k], &status, 0) == workers[k] && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+	}
+	if (!ok) {
+		for (const std::string& name : names) { shm_unlink(name.c_str()); }
+		std::cout << "A shard worker failed, the shards were not replaced." << std::endl;
+		return false;
+	}
+	for (size_t k = 0; k < which.size(); k++) {  // swap in the new shards only once every worker has read the old ones
+		int s = which[k];
+		if (shards_[s]) {
+			shards_[s]->close();
+			shm_unlink(names_[s].c_str());
+		}
+		else {
+			shards_[s] = new OctreeView<Tname>(writer_.func);
+		}
+		names_[s] = names[k];
+		ok = shards_[s]->openShared(names_[s].c_str()) && ok;
+	}
+	return ok;
+#else
+	std::cout << "Sharded octrees need POSIX processes and shared memory." << std::endl;
+	return false;
+#endif
+}
+
+template <triviallyCopyable Tname> bool ShardedOctree<Tname>::build(Tname* Objects, int size) {
+	// Bucket by top tree cell, counting sorted so each bucket's objects are contiguous
+	Node<Tname> bounds;
+	const OctreeFileNode& root = top_[0];
+	bounds.xMax_ = root.xMax_; bounds.xMin_ = root.xMin_; bounds.yMax_ = root.yMax_; bounds.yMin_ = root.yMin_; bounds.zMax_ = root.zMax_; bounds.zMin_ = root.zMin_;
+	std::vector<int> buckets(size);
+	std::fill(bucketCounts_.begin(), bucketCounts_.end(), 0);
+	std::fill(bucketSums_.begin(), bucketSums_.end(), vec3{ 0, 0, 0 });
+	dropped_ = 0;
+	for (int i = 0; i < size; i++) {
+		vec3 V = writer_.func(Objects[i]);
+		if (!bounds.contains(V)) {
+			buckets[i] = -1;
+			dropped_++;
+			continue;
+		}
+		buckets[i] = writer_.getBucket(V);
+		bucketCounts_[buckets[i]]++;
+		bucketSums_[buckets[i]] = bucketSums_[buckets[i]] + V;
+	}
+	if (dropped_ > 0) {
+		std::cout << dropped_ << " objects were outside the octree bounds and were dropped." << std::endl;
+	}
+	std::vector<uint64_t> bucketStart(numBuckets_ + 1, 0);
+	for (int b = 0; b < numBuckets_; b++) {
+		bucketStart[b + 1] = bucketStart[b] + bucketCounts_[b];
+	}
+	std::vector<Tname> sorted(bucketStart[numBuckets_]);
+	std::vector<uint64_t> next(bucketStart.begin(), bucketStart.end() - 1);
+	for (int i = 0; i < size; i++) {
+		if (buckets[i] >= 0) { sorted[next[buckets[i]]++] = Objects[i]; }
+	}
+	// Shards keep their ranges, and so their regions, while the sizes stay within tolerance
+	if (getImbalance() > 1 + tolerance_) {
+		planRanges();
+	}
+	makeTop();
+	std::vector<int> all(numShards_);
+	for (int s = 0; s < numShards_; s++) {
+		all[s] = s;
+	}
+	return buildShards(all, [&sorted, &bucketStart](int b, std::vector<Tname>& objs) {
+		objs.assign(sorted.begin() + bucketStart[b], sorted.begin() + bucketStart[b + 1]);
+	});
+}
+
+template <triviallyCopyable Tname> bool ShardedOctree<Tname>::rebalance() {
+	for (int s = 0; s < numShards_; s++) {
+		if (!shards_[s]) {
+			std::cout << "Build the shards before rebalancing them." << std::endl;
+			return false;
+		}
+	}
+	std::vector<int> oldRanges = rangeStart_;
+	planRanges();
+	std::vector<int> moved;
+	for (int s = 0; s < numShards_; s++) {
+		if (rangeStart_[s] != oldRanges[s] || rangeStart_[s + 1] != oldRanges[s + 1]) { moved.push_back(s); }
+	}
+	if (moved.empty()) { return true; }
+	// A bucket's objects are contiguous in its old shard, so workers copy them from that mapping
+	bool ok = buildShards(moved, [this, &oldRanges](int b, std::vector<Tname>& objs) {
+		const OctreeView<Tname>& shard = *shards_[getOwner(b, oldRanges)];
+		const OctreeFileNode* node = bucketNode(shard, b);
+		if (node) { objs.assign(shard.getNodeData(node), shard.getNodeData(node) + node->num_); }
+		else { objs.clear(); }
+	});
+	if (!ok) { rangeStart_ = oldRanges; }
+	return ok;
+}
+
+template <triviallyCopyable Tname> void ShardedOctree<Tname>::close() {
+	for (int s = 0; s < numShards_; s++) {
+		if (!shards_[s]) { continue; }
+		shards_[s]->close();
+		delete shards_[s];
+		shards_[s] = nullptr;
+#ifdef OCTREE_MMAP
+		shm_unlink(names_[s].c_str());
+#endif
+		names_[s].clear();
+	}
+}
+
+// ShardedOctree query functions
+template <triviallyCopyable Tname> int ShardedOctree<Tname>::findShard(const double X, const double Y, const double Z) const {
+	const OctreeFileNode& root = top_[0];
+	if (X > root.xMax_ || X < root.xMin_ || Y > root.yMax_ || Y < root.yMin_ || Z > root.zMax_ || Z < root.zMin_) {
+		return -1;
+	}
+	return getOwner(writer_.getBucket(vec3{ X, Y, Z }), rangeStart_);
+}
+
+template <triviallyCopyable Tname> const OctreeFileNode* ShardedOctree<Tname>::findLeafNode(const double X, const double Y, const double Z) const {
+	int s = findShard(X, Y, Z);
+	return (s >= 0 && shards_[s]) ? shards_[s]->findLeafNode(X, Y, Z) : nullptr;
+}
+
+template <triviallyCopyable Tname>
+template <typename F>
+void ShardedOctree<Tname>::rangeQuery(double xMin, double xMax, double yMin, double yMax, double zMin, double zMax, F&& visit) const {
+	std::vector<bool> hit(numShards_, false);
+	for (int b = 0; b < numBuckets_; b++) {  // the top tree routes the query to the shards it touches
+		const OctreeFileNode& cell = top_[topIndx(writer_.prefixLevels_, b)];
+		if (cell.num_ > 0 && cell.xMin_ <= xMax && cell.xMax_ >= xMin && cell.yMin_ <= yMax && cell.yMax_ >= yMin && cell.zMin_ <= zMax && cell.zMax_ >= zMin) {
+			hit[getOwner(b, rangeStart_)] = true;
+		}
+	}
+	for (int s = 0; s < numShards_; s++) {
+		if (hit[s] && shards_[s]) { shards_[s]->rangeQuery(xMin, xMax, yMin, yMax, zMin, zMax, visit); }
+	}
+}
+
+template <triviallyCopyable Tname>
+template <typename F>
+void ShardedOctree<Tname>::walk(F&& visit) const {
+	std::vector<std::pair<int, int>> topStack{ { 0, 0 } };  // levels and cells of the top tree
+	std::vector<const OctreeFileNode*> stack;
+	while (!topStack.empty()) {
+		auto [level, cell] = topStack.back();
+		topStack.pop_back();
+		if (level == writer_.prefixLevels_) {  // a bucket, continue in the shard owning it
+			const OctreeView<Tname>* shard = shards_[getOwner(cell, rangeStart_)];
+			const OctreeFileNode* node = shard ? bucketNode(*shard, cell) : nullptr;
+			if (node) { stack.push_back(node); }
+			while (!stack.empty()) {
+				node = stack.back();
+				stack.pop_back();
+				if (!visit(*node, shard->getNodeData(node))) { continue; }
+				for (int i = 7; i >= 0; i--) {
+					if (shard->getChild(node, i)) { stack.push_back(shard->getChild(node, i)); }
+				}
+			}
+			continue;
+		}
+		const OctreeFileNode& node = top_[topIndx(level, cell)];
+		if (node.num_ > 0 && visit(node, (const Tname*)nullptr)) {  // top nodes span shards, so have no contiguous objects
+			for (int i = 7; i >= 0; i--) {
+				topStack.push_back({ level + 1, cell * 8 + i });
+			}
+		}
+	}
+}
+
+template <typename Tsrc = vec3>
+class IndexOctree {  // Octree over an external array or SoA coordinates, leaves hold 32 bit indices only
+private:
+	typedef vec3(*srcToCoord)(const Tsrc& Obj);
+	const Tsrc* objs_;  // caller's array (AoS mode)
+	srcToCoord srcFunc_;
+	const double* xs_, * ys_, * zs_;  // caller's coordinate arrays (SoA mode)
+	uint32_t size_;
+	Octree<uint32_t>* tree_;
+
+	static vec3 aosCoord(uint32_t& indx, const void* context) {
+		const IndexOctree<Tsrc>* index = (const IndexOctree<Tsrc>*)context;
+		return index->srcFunc_(index->objs_[indx]);
+	}
+	static vec3 soaCoord(uint32_t& indx, const void* context) {
+		const IndexOctree<Tsrc>* index = (const IndexOctree<Tsrc>*)context;
+		return vec3{ index->xs_[indx], index->ys_[indx], index->zs_[indx] };
+	}
+	void make(int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax);
+	void renumberNode(Node<uint32_t>* node, uint32_t& counter);  // Indices in depth first order
+
+public:
+	IndexOctree(const Tsrc* Objects, srcToCoord funcToPlace, uint32_t objArrSize, int maxDepth, int maxLeafSize, double xMin = 0, double xMax = 0, double yMin = 0, double yMax = 0, double zMin = 0, double zMax = 0);  // Array of objects
+	IndexOctree(const double* xs, const double* ys, const double* zs, uint32_t objArrSize, int maxDepth, int maxLeafSize, double xMin = 0, double xMax = 0, double yMin = 0, double yMax = 0, double zMin = 0, double zMax = 0);  // Separate coordinate arrays
+	~IndexOctree() { delete tree_; }  // Destructor
+	IndexOctree(const IndexOctree<Tsrc>&) = delete;  // the tree refers back to this object
+	IndexOctree& operator = (const IndexOctree<Tsrc>&) = delete;
+
+	// getter functions
+	Octree<uint32_t>& getTree() { return *tree_; }  // Queries return indices into the caller's arrays
+	const Octree<uint32_t>& getTree() const { return *tree_; }
+	uint32_t getSize() const { return size_; }
+
+	// Member functions
+	std::vector<uint32_t> getTreeOrder() const;  // Old index of each position in depth first leaf order
+	template<typename... Ts> void reorder(Ts*... arrays);  // Permute the caller's arrays into tree order and renumber the leaves
+};
+
+// IndexOctree constructors
+template <typename Tsrc> IndexOctree<Tsrc>::IndexOctree(const Tsrc* Objects, srcToCoord funcToPlace, uint32_t objArrSize, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax)
+	: objs_(Objects), srcFunc_(funcToPlace), xs_(nullptr), ys_(nullptr), zs_(nullptr), size_(objArrSize), tree_(nullptr) {
+	make(maxDepth, maxLeafSize, xMin, xMax, yMin, yMax, zMin, zMax);
+}
+
+template <typename Tsrc> IndexOctree<Tsrc>::IndexOctree(const double* xs, const double* ys, const double* zs, uint32_t objArrSize, int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax)
+	: objs_(nullptr), srcFunc_(nullptr), xs_(xs), ys_(ys), zs_(zs), size_(objArrSize), tree_(nullptr) {
+	make(maxDepth, maxLeafSize, xMin, xMax, yMin, yMax, zMin, zMax);
+}
+
+template <typename Tsrc> void IndexOctree<Tsrc>::make(int maxDepth, int maxLeafSize, double xMin, double xMax, double yMin, double yMax, double zMin, double zMax) {
+	uint32_t* indices = new uint32_t[size_];
+	for (uint32_t i = 0; i < size_; i++) { indices[i] = i; }
+	tree_ = new Octree<uint32_t>(indices, objs_ ? &aosCoord : &soaCoord, this, (int)size_, maxDepth, maxLeafSize, xMin, xMax, yMin, yMax, zMin, zMax);
+	delete[] indices;  // build copies the indices into the leaves
+}
+
+// IndexOctree reorder functions
+template <typename Tsrc> std::vector<uint32_t> IndexOctree<Tsrc>::getTreeOrder() const {
+	std::vector<uint32_t> order(tree_->getDataSize(tree_->getRoot()));
+	if (!order.empty()) { tree_->copyTreeData(tree_->getRoot(), order.data()); }
+	return order;
+}
+
+template <typename Tsrc> void IndexOctree<Tsrc>::renumberNode(Node<uint32_t>* node, uint32_t& counter) {
+	if (node->hasChildren()) {
+		for (int i = 0; i < node->numChildren(); i++) {
+			renumberNode(node->child_[i], counter);
+		}
+		return;
+	}
+	for (int j = 0; j < node->num_; j++) {
+		node->Objs_[j] = counter++;
+	}
+}
+
+template <typename Tsrc>
+template<typename... Ts>
+void IndexOctree<Tsrc>::reorder(Ts*... arrays) {  // the coordinate source must be among the arrays, and every index must be in the tree
+	std::vector<uint32_t> order = getTreeOrder();
+	if (order.size() != size_) {
+		std::cout << "Cannot reorder, " << size_ - order.size() << " objects are outside the tree." << std::endl;
+		return;
+	}
+	(applyOrder(order, arrays), ...);
+	uint32_t counter = 0;
+	renumberNode(tree_->getRoot(), counter);
 }
 
 #endif // !OCTREE_H
\ No newline at end of file
@@ -0,0 +1,230 @@
+// Benchmarks
+// Compile with g++ -std=c++20 -o EllieOctreeBenchmarks -pthread -O3 benchmarks.cpp
+// Run with ./EllieOctreeBenchmarks [--sizes 1000,10000,100000,1000000] [--threads 1,4] [--dists uniform,plummer,blobs,planar,duplicated]
+//	[--reps 3] [--seed 1] [--depth 12] [--leaf 16] [--json EllieOctreeBenchmarks.json]
+// Every run with the same seed and options generates the same points, so JSON files from two builds can be compared directly
+
+#include "../include/EllieOctree.hpp"
+#include <chrono>
+#include <random>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cmath>
+
+struct BenchResult {  // timings of one operation for one distribution, size and thread count
+	std::string dist_, op_;
+	int size_, threads_, count_;  // count_ is the number of objects or queries the operation handles
+	std::vector<double> times_;  // seconds per repetition
+};
+
+vec3 indexCoords(uint32_t& i, const void* context) {
+	return (*(const std::vector<vec3>*)context)[i];
+}  // trees hold indices into a coordinate vector, so updates only need to edit the vector
+
+std::vector<std::string> splitList(const std::string& list) {
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty()) { items.push_back(item); }
+	}
+	return items;
+}
+
+std::vector<vec3> makePool(const std::string& dist, int size, std::mt19937_64& gen) {
+	// Blob centres for "blobs", or the repeated points for "duplicated"
+	std::uniform_real_distribution<> uni(0, 1);
+	std::vector<vec3> pool;
+	if (dist == "blobs") {
+		for (int i = 0; i < 16; i++) { pool.push_back(vec3{ 0.1 + 0.8 * uni(gen), 0.1 + 0.8 * uni(gen), 0.1 + 0.8 * uni(gen) }); }
+	}
+	else if (dist == "duplicated") {  // every point is repeated about 100 times
+		for (int i = 0; i < std::max(1, size / 100); i++) { pool.push_back(vec3{ uni(gen), uni(gen), uni(gen) }); }
+	}
+	return pool;
+}
+
+vec3 samplePoint(const std::string& dist, const std::vector<vec3>& pool, std::mt19937_64& gen) {
+	std::uniform_real_distribution<> uni(0, 1);
+	if (dist == "plummer") {  // Plummer sphere with scale radius 0.05, truncated to the unit cube
+		double r;
+		do {
+			r = 0.05 / std::sqrt(std::pow(1 - uni(gen), -2.0 / 3.0) - 1);
+		} while (r > 0.5);
+		double cosTheta = 2 * uni(gen) - 1;
+		double sinTheta = std::sqrt(1 - cosTheta * cosTheta);
+		double phi = 2 * 3.14159265358979323846 * uni(gen);
+		return vec3{ 0.5 + r * sinTheta * std::cos(phi), 0.5 + r * sinTheta * std::sin(phi), 0.5 + r * cosTheta };
+	}
+	if (dist == "blobs") {  // Gaussian blobs of width 0.02
+		std::normal_distribution<> normal(0, 0.02);
+		const vec3& centre = pool[gen() % pool.size()];
+		return vec3{ std::clamp(centre.x_ + normal(gen), 0.0, 1.0), std::clamp(centre.y_ + normal(gen), 0.0, 1.0), std::clamp(centre.z_ + normal(gen), 0.0, 1.0) };
+	}
+	if (dist == "planar") {  // sheet of thickness 0.001
+		return vec3{ uni(gen), uni(gen), 0.5 + 0.001 * (uni(gen) - 0.5) };
+	}
+	if (dist == "duplicated") {
+		return pool[gen() % pool.size()];
+	}
+	return vec3{ uni(gen), uni(gen), uni(gen) };  // uniform
+}
+
+template<typename Setup, typename Op> void timeOp(std::vector<BenchResult>& results, const BenchResult& info, int reps, Setup setup, Op op) {
+	// setup() runs untimed before each repetition of op()
+	BenchResult result = info;
+	for (int r = 0; r < reps; r++) {
+		setup();
+		auto t0 = std::chrono::steady_clock::now();
+		op();
+		auto t1 = std::chrono::steady_clock::now();
+		result.times_.push_back(std::chrono::duration<double>(t1 - t0).count());
+	}
+	std::vector<double> sorted = result.times_;
+	std::sort(sorted.begin(), sorted.end());
+	std::cout << result.dist_ << " n=" << result.size_ << " threads=" << result.threads_ << " " << result.op_ << ": "
+		<< sorted[sorted.size() / 2] * 1e3 << "ms median, " << sorted[0] * 1e9 / std::max(1, result.count_) << "ns per item best" << std::endl;
+	results.push_back(result);
+}
+
+bool writeJson(const char* path, const std::vector<BenchResult>& results, uint64_t seed, int maxDepth, int maxLeaf) {
+	std::ofstream file(path);
+	if (!file) {
+		std::cout << "Could not open " << path << " for writing." << std::endl;
+		return false;
+	}
+	file.precision(9);
+	file << "{\n  \"seed\": " << seed << ",\n  \"maxDepth\": " << maxDepth << ",\n  \"maxLeaf\": " << maxLeaf
+		<< ",\n  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& result = results[i];
+		std::vector<double> sorted = result.times_;
+		std::sort(sorted.begin(), sorted.end());
+		file << "    { \"distribution\": \"" << result.dist_ << "\", \"operation\": \"" << result.op_ << "\", \"size\": " << result.size_
+			<< ", \"threads\": " << result.threads_ << ", \"count\": " << result.count_
+			<< ", \"min_s\": " << sorted[0] << ", \"median_s\": " << sorted[sorted.size() / 2] << ", \"max_s\": " << sorted.back()
+			<< ", \"ns_per_item\": " << sorted[sorted.size() / 2] * 1e9 / std::max(1, result.count_) << ", \"times_s\": [";
+		for (size_t r = 0; r < result.times_.size(); r++) {
+			file << (r ? ", " : "") << result.times_[r];
+		}
+		file << "] }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	file << "  ]\n}\n";
+	return (bool)file;
+}
+
+int main(int argc, char** argv) {
+	std::vector<std::string> dists{ "uniform", "plummer", "blobs", "planar", "duplicated" };
+	std::vector<int> sizes{ 1000, 10000, 100000, 1000000 };
+	std::vector<int> threadCounts{ 1, std::max(1, (int)std::thread::hardware_concurrency()) };
+	int reps = 3, maxDepth = 12, maxLeaf = 16;
+	uint64_t seed = 1;
+	std::string jsonPath = "EllieOctreeBenchmarks.json";
+	for (int a = 1; a + 1 < argc; a += 2) {  // options all take a value
+		std::string option = argv[a], value = argv[a + 1];
+		if (option == "--dists") { dists = splitList(value); }
+		else if (option == "--sizes") {
+			sizes.clear();
+			for (std::string& size : splitList(value)) { sizes.push_back((int)std::stod(size)); }  // accepts 1e8
+		}
+		else if (option == "--threads") {
+			threadCounts.clear();
+			for (std::string& threads : splitList(value)) { threadCounts.push_back(std::stoi(threads)); }
+		}
+		else if (option == "--reps") { reps = std::max(1, std::stoi(value)); }
+		else if (option == "--seed") { seed = std::stoull(value); }
+		else if (option == "--depth") { maxDepth = std::stoi(value); }
+		else if (option == "--leaf") { maxLeaf = std::stoi(value); }
+		else if (option == "--json") { jsonPath = value; }
+		else { std::cout << "Unknown option " << option << "." << std::endl; return 1; }
+	}
+	std::sort(threadCounts.begin(), threadCounts.end());
+	threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+	std::vector<BenchResult> results;
+	for (const std::string& dist : dists) {
+		for (int size : sizes) {
+			std::mt19937_64 gen(seed);  // same points for every build being compared
+			std::vector<vec3> pool = makePool(dist, size, gen);
+			std::vector<vec3> base(size);
+			for (int i = 0; i < size; i++) {
+				base[i] = samplePoint(dist, pool, gen);
+			}
+			int extra = std::max(1, size / 100);  // objects added by the insert benchmarks
+			std::vector<vec3> coords;
+			coords.reserve(size + extra + 1);
+			std::vector<uint32_t> indices(size);
+			for (int i = 0; i < size; i++) {
+				indices[i] = i;
+			}
+			Octree<uint32_t>* tree = nullptr;
+			auto rebuild = [&]() {  // fresh tree over the base points
+				delete tree;
+				coords.assign(base.begin(), base.end());
+				tree = new Octree<uint32_t>(indices.data(), indexCoords, &coords, size, maxDepth, maxLeaf, 0, 1, 0, 1, 0, 1);
+			};
+			std::vector<vec3> movers(size), queries(std::min(size, 100000)), inserts(extra);
+			for (vec3& V : movers) { V = samplePoint(dist, pool, gen); }
+			for (vec3& V : queries) { V = samplePoint(dist, pool, gen); }
+			for (vec3& V : inserts) { V = samplePoint(dist, pool, gen); }
+
+			// Serial operations
+			timeOp(results, BenchResult{ dist, "build", size, 1, size, {} }, reps, [&]() { delete tree; tree = nullptr; coords.assign(base.begin(), base.end()); },
+				[&]() { tree = new Octree<uint32_t>(indices.data(), indexCoords, &coords, size, maxDepth, maxLeaf, 0, 1, 0, 1, 0, 1); });
+			timeOp(results, BenchResult{ dist, "insert_in", size, 1, extra, {} }, reps, [&]() {
+				rebuild();
+				coords.insert(coords.end(), inserts.begin(), inserts.end());
+			}, [&]() {
+				for (int i = 0; i < extra; i++) { tree->stage((uint32_t)(size + i)); }
+				tree->flush();
+			});
+			timeOp(results, BenchResult{ dist, "insert_out", size, 1, 1, {} }, reps, [&]() {
+				rebuild();
+				coords.push_back(vec3{ 1.5, 0.5, 0.5 });  // grows the root bounds, so the tree is rebuilt
+			}, [&]() { tree->addToTree((uint32_t)size); });
+
+			// Operations taking a thread count
+			for (int threads : threadCounts) {
+				const double fractions[3] = { 0.01, 0.1, 1.0 };
+				const char* updateOps[3] = { "update_1pct", "update_10pct", "update_100pct" };
+				for (int f = 0; f < 3; f++) {
+					int stride = (int)std::lround(1 / fractions[f]);
+					timeOp(results, BenchResult{ dist, updateOps[f], size, threads, (size + stride - 1) / stride, {} }, reps, [&]() {
+						rebuild();
+						for (int i = 0; i < size; i += stride) { coords[i] = movers[i]; }
+					}, [&]() {
+						uint32_t* lost = tree->parallelUpdateTree(threads);
+						delete[] lost;
+					});
+				}
+				timeOp(results, BenchResult{ dist, "concurrent_insert", size, threads, extra, {} }, reps, [&]() {
+					rebuild();
+					coords.insert(coords.end(), inserts.begin(), inserts.end());
+				}, [&]() {
+					parallelFor(extra, threads, [&](int i) { tree->concurrentInsert((uint32_t)(size + i)); });
+					tree->consolidate();
+				});
+				rebuild();
+				Octree<uint32_t> copy;
+				timeOp(results, BenchResult{ dist, "copy", size, threads, size, {} }, reps, []() {}, [&]() { copy.cloneFrom(*tree, threads); });
+				std::atomic<int64_t> found(0);
+				timeOp(results, BenchResult{ dist, "find_leaf", size, threads, (int)queries.size(), {} }, reps, []() {}, [&]() {
+					int chunk = 1024;
+					parallelFor(((int)queries.size() + chunk - 1) / chunk, threads, [&](int c) {
+						int64_t local = 0;
+						for (int i = c * chunk; i < std::min((int)queries.size(), (c + 1) * chunk); i++) {
+							Node<uint32_t>* leaf = tree->findLeafNode(queries[i].x_, queries[i].y_, queries[i].z_);
+							local += leaf ? leaf->num_ : 0;
+						}
+						found += local;  // keeps the lookups from being optimised away
+					});
+				});
+			}
+			delete tree;
+		}
+	}
+	if (!writeJson(jsonPath.c_str(), results, seed, maxDepth, maxLeaf)) { return 1; }
+	std::cout << results.size() << " results written to " << jsonPath << "." << std::endl;
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include <chrono>
 #include <random>
 #include <memory>
+#include <cmath>
 
 vec3 vec3SmrtPntrCoords(std::shared_ptr<vec3>& vec) {
 	vec3 V;
@@ -19,6 +20,10 @@ vec3 vec3Coords(vec3& vec) {
 	return V;
 }  // returns vec3 obj coords (for octree)
 
+box3 vec3Box(vec3& vec) {
+	return box3{ vec - 0.0002, vec + 0.0002 };
+}  // returns a small box around the vec3 (for collision tests)
+
 
 int main() {
 	int numParts = 1000000;
@@ -48,6 +53,381 @@ int main() {
 	}
 	// Update octree
 	octree3->updateTree(octree3->getRoot());
+	// Write the octree to disk, then map it back read-only and query it
+	auto t0a = std::chrono::high_resolution_clock::now();
+	octree3->writeFile("EllieOctreeTests.bin");
+	auto t0b = std::chrono::high_resolution_clock::now();
+	OctreeView<vec3> octreeView(vec3Coords);
+	octreeView.open("EllieOctreeTests.bin");
+	auto t0c = std::chrono::high_resolution_clock::now();
+	int inRange = 0;
+	octreeView.rangeQuery(0.25, 0.5, 0.25, 0.5, 0.25, 0.5, [&inRange](const vec3&) { inRange++; });
+	std::cout << "Octree write time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0b - t0a).count() << "ms, open time: "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(t0c - t0b).count() << "us, "
+		<< inRange << " particles in range query on mapped file, central leaf has " << octreeView.findLeafNode(0.5, 0.5, 0.5)->num_ << " particles." << std::endl;
+	octreeView.close();
+	// Build the same file out of core, streaming the particles from disk in chunks
+	FILE* particleFile = fopen("EllieOctreeParticles.bin", "wb");
+	fwrite(particleList, sizeof(vec3), numParts, particleFile);
+	fclose(particleFile);
+	auto t0d = std::chrono::high_resolution_clock::now();
+	OctreeStreamBuilder<vec3> streamBuilder(vec3Coords, 3, 16, 0, 1, 0, 1, 0, 1);
+	streamBuilder.buildFromFile("EllieOctreeParticles.bin", "EllieOctreeTests.bin");
+	auto t0e = std::chrono::high_resolution_clock::now();
+	octreeView.open("EllieOctreeTests.bin");
+	std::cout << "Streamed octree build time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0e - t0d).count() << "ms, root has " << octreeView.getRoot()->num_ << " particles." << std::endl;
+	octreeView.close();
+	std::remove("EllieOctreeParticles.bin");
+	std::remove("EllieOctreeTests.bin");
+	// Index the particle array in place, storing only indices, then reorder it into tree order
+	auto t0f = std::chrono::high_resolution_clock::now();
+	IndexOctree<vec3> indexOctree(particleList, [](const vec3& vec) { return vec; }, numParts, 3, 16, 0, 1, 0, 1, 0, 1);
+	auto t0g = std::chrono::high_resolution_clock::now();
+	indexOctree.reorder(particleList);
+	auto t0h = std::chrono::high_resolution_clock::now();
+	Node<uint32_t>* indexLeaf = indexOctree.getTree().findLeafNode(0.5, 0.5, 0.5);
+	std::cout << "Index octree build time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0g - t0f).count() << "ms, reorder time: "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(t0h - t0g).count() << "ms, central leaf holds particles "
+		<< indexLeaf->Objs_[0] << " to " << indexLeaf->Objs_[indexLeaf->num_ - 1] << "." << std::endl;
+	// Flatten the particles onto a thin sheet, so most octants are empty and never allocated
+	for (int i = 0; i < numParts; i++) {
+		particleList[i].z_ = 0.5 + 0.001 * particleList[i].z_;
+	}
+	auto t0i = std::chrono::high_resolution_clock::now();
+	Octree<vec3>* sheetOctree = new Octree<vec3>(particleList, vec3Coords, numParts, 6, 16, 0, 1, 0, 1, 0, 1);
+	auto t0j = std::chrono::high_resolution_clock::now();
+	std::cout << "Sheet octree build time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0j - t0i).count() << "ms, root has "
+		<< sheetOctree->getRoot()->numChildren() << " children, leaf off the sheet is " << (sheetOctree->findLeafNode(0.5, 0.5, 0.9) ? "present" : "absent")
+		<< ", data size " << sheetOctree->getDataSize(sheetOctree->getRoot()) << "." << std::endl;
+	// Sort the particle array and a companion array into the sheet octree's leaf order
+	int* particleIds = new int[numParts];
+	for (int i = 0; i < numParts; i++) {
+		particleIds[i] = i;
+	}
+	auto t0k = std::chrono::high_resolution_clock::now();
+	sheetOctree->reorder(particleList, numParts, particleIds);
+	auto t0l = std::chrono::high_resolution_clock::now();
+	int leafChanges = 0;
+	for (int i = 1; i < numParts; i++) {
+		leafChanges += sheetOctree->findLeafNode(particleList[i].x_, particleList[i].y_, particleList[i].z_) != sheetOctree->findLeafNode(particleList[i - 1].x_, particleList[i - 1].y_, particleList[i - 1].z_);
+	}
+	std::cout << "Sheet octree reorder time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0l - t0k).count() << "ms, " << leafChanges + 1 << " runs of particles sharing a leaf for "
+		<< sheetOctree->stats().numLeaves_ << " leaves." << std::endl;
+	delete[] particleIds;
+	delete sheetOctree;
+	// Count what a build and an update do, with the counting instrumentation policy
+	std::vector<uint32_t> countedIndices(numParts);
+	for (int i = 0; i < numParts; i++) {
+		countedIndices[i] = i;
+	}
+	Octree<uint32_t, CountingInstrumentation>* countedOctree = new Octree<uint32_t, CountingInstrumentation>(countedIndices.data(),
+		[](uint32_t& i, const void* context) { return ((const vec3*)context)[i]; }, particleList, numParts, 6, 16, 0, 1, 0, 1, 0, 1);
+	CountingInstrumentation::print();
+	CountingInstrumentation::reset();
+	for (int i = 0; i < numParts; i += 10) {  // lift a tenth of the particles off the sheet
+		particleList[i].z_ = uni(gen);
+	}
+	uint32_t* countedLost = countedOctree->parallelUpdateTree();
+	std::cout << "Counted octree update, " << CountingInstrumentation::totals()[OctreeCounter::Migrated] << " particles migrated, "
+		<< CountingInstrumentation::totals()[OctreeCounter::Splits] << " splits, " << CountingInstrumentation::totals()[OctreeCounter::CoordCalls] << " coordinate calls." << std::endl;
+	if (countedLost) { delete[] countedLost; }
+	delete countedOctree;
+	// Index the same particles with compact nodes, which drop the parent pointer, c.o.d. and content bounds
+	auto t0m = std::chrono::high_resolution_clock::now();
+	Octree<vec3, NoInstrumentation, IndexNode>* compactOctree = new Octree<vec3, NoInstrumentation, IndexNode>(particleList, vec3Coords, numParts, 6, 16, 0, 1, 0, 1, 0, 1);
+	auto t0n = std::chrono::high_resolution_clock::now();
+	std::cout << "Compact node octree build time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0n - t0m).count() << "ms, " << sizeof(Node<vec3, IndexNode>) << " bytes per node instead of "
+		<< sizeof(Node<vec3>) << ", " << compactOctree->stats().nodeBytes_ / 1024 << "KB in nodes." << std::endl;
+	delete compactOctree;
+	// Index the particles' x and y coordinates in a quadtree
+	auto t0o = std::chrono::high_resolution_clock::now();
+	Quadtree<vec3>* quadtree = new Quadtree<vec3>(particleList, vec3Coords, numParts, 8, 16, 0, 1, 0, 1);
+	auto t0p = std::chrono::high_resolution_clock::now();
+	std::cout << "Quadtree build time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0p - t0o).count() << "ms, root has " << quadtree->getRoot()->numChildren() << " children, "
+		<< sizeof(Node<vec3, QuadNode>) << " bytes per node, " << quadtree->stats().numLeaves_ << " leaves." << std::endl;
+	delete quadtree;
+	// Build octrees over tight clusters with midpoint, median and surface area split planes
+	int numClustered = numParts / 5;
+	std::normal_distribution<> cluster(0, 0.0005);
+	vec3* clusteredList = new vec3[numClustered];
+	for (int i = 0; i < numClustered; i++) {
+		double c = 0.2 + 0.15 * (i % 5);  // five clusters along the diagonal
+		clusteredList[i] = vec3{ std::clamp(c + cluster(gen), 0.0, 1.0), std::clamp(c + cluster(gen), 0.0, 1.0), std::clamp(c + cluster(gen), 0.0, 1.0) };
+	}
+	auto clusterReport = [&](const char* name, auto* tree, long long ms) {
+		auto clusterStats = tree->stats();
+		int notFound = 0;
+		for (int i = 0; i < numClustered; i++) {
+			auto* leaf = tree->findLeafNode(clusteredList[i].x_, clusteredList[i].y_, clusteredList[i].z_);
+			notFound += !leaf || !leaf->contains(clusteredList[i]);
+		}
+		std::cout << name << " split octree build time: " << ms << "ms, " << clusterStats.numNodes_ << " nodes, " << clusterStats.leafOccupancy_.back()
+			<< " overfull leaves, mean particle depth " << clusterStats.meanObjDepth_ << ", " << notFound << " particles not found." << std::endl;
+	};
+	auto t0q = std::chrono::high_resolution_clock::now();
+	Octree<vec3>* midpointOctree = new Octree<vec3>(clusteredList, vec3Coords, numClustered, 8, 16, 0, 1, 0, 1, 0, 1);
+	auto t0r = std::chrono::high_resolution_clock::now();
+	clusterReport("Midpoint", midpointOctree, std::chrono::duration_cast<std::chrono::milliseconds>(t0r - t0q).count());
+	delete midpointOctree;
+	Octree<vec3, NoInstrumentation, MedianNode>* medianOctree = new Octree<vec3, NoInstrumentation, MedianNode>(clusteredList, vec3Coords, numClustered, 8, 16, 0, 1, 0, 1, 0, 1);
+	auto t0s = std::chrono::high_resolution_clock::now();
+	clusterReport("Median", medianOctree, std::chrono::duration_cast<std::chrono::milliseconds>(t0s - t0r).count());
+	delete medianOctree;
+	auto t0t = std::chrono::high_resolution_clock::now();
+	Octree<vec3, NoInstrumentation, SurfaceAreaNode>* areaOctree = new Octree<vec3, NoInstrumentation, SurfaceAreaNode>(clusteredList, vec3Coords, numClustered, 8, 16, 0, 1, 0, 1, 0, 1);
+	auto t0u = std::chrono::high_resolution_clock::now();
+	clusterReport("Surface area", areaOctree, std::chrono::duration_cast<std::chrono::milliseconds>(t0u - t0t).count());
+	delete areaOctree;
+	delete[] clusteredList;
+	// Build the particles as 4 shards in worker processes, with a top tree routing queries and walks to the owning shard
+	ShardedOctree<vec3> shardedOctree(vec3Coords, 8, 16, 0, 1, 0, 1, 0, 1, 4);
+	auto t0v = std::chrono::high_resolution_clock::now();
+	bool sharded = shardedOctree.build(particleList, numParts);
+	auto t0w = std::chrono::high_resolution_clock::now();
+	if (!sharded) {
+		std::cout << "Sharded octree build failed." << std::endl;
+		return 1;
+	}
+	const OctreeFileNode* centralLeaf = shardedOctree.findLeafNode(0.5, 0.5, 0.5);  // nullptr when the centre falls in an empty octant
+	int accepted = 0;
+	long long walked = 0;
+	shardedOctree.walk([&](const OctreeFileNode& node, const vec3* objs) {  // Barnes-Hut style walk from the centre, opening nodes larger than half their distance
+		double dist = std::sqrt((node.x_ - 0.5) * (node.x_ - 0.5) + (node.y_ - 0.5) * (node.y_ - 0.5) + (node.z_ - 0.5) * (node.z_ - 0.5));
+		if (objs && node.leaf_) { walked += node.num_; return false; }
+		if (node.xMax_ - node.xMin_ < 0.5 * dist) { accepted++; walked += node.num_; return false; }
+		return true;
+	});
+	std::cout << "Sharded octree build time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0w - t0v).count() << "ms, imbalance " << shardedOctree.getImbalance()
+		<< ", central leaf has " << (centralLeaf ? centralLeaf->num_ : 0) << " particles, walk accepted " << accepted << " nodes covering " << walked << " particles." << std::endl;
+	for (int i = 0; i < numParts; i++) {  // crowd the particles towards x = 0
+		particleList[i].x_ = particleList[i].x_ * particleList[i].x_ * particleList[i].x_;
+	}
+	shardedOctree.setTolerance(10);  // keep the old ranges on the rebuild, so rebalance() has to move them
+	shardedOctree.build(particleList, numParts);
+	double drifted = shardedOctree.getImbalance();
+	auto t0x = std::chrono::high_resolution_clock::now();
+	shardedOctree.rebalance();
+	auto t0y = std::chrono::high_resolution_clock::now();
+	std::cout << "Sharded octree rebalance time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0y - t0x).count() << "ms, imbalance " << drifted << " before and "
+		<< shardedOctree.getImbalance() << " after." << std::endl;
+	shardedOctree.close();
+	// A third of the particles in one cluster, which a cut after the quantile crossing bucket would hand to one shard with everything before it
+	int numSharded = 60000;
+	vec3* shardedList = new vec3[numSharded];
+	for (int i = 0; i < numSharded; i++) {
+		shardedList[i] = (i % 3 == 0) ? vec3{ std::clamp(0.3 + cluster(gen), 0.0, 1.0), std::clamp(0.3 + cluster(gen), 0.0, 1.0), std::clamp(0.3 + cluster(gen), 0.0, 1.0) } : vec3{ uni(gen), uni(gen), uni(gen) };
+	}
+	ShardedOctree<vec3> clusteredShards(vec3Coords, 8, 16, 0, 1, 0, 1, 0, 1, 4, 2, "/ellieclustered");
+	bool clusteredBuilt = clusteredShards.build(shardedList, numSharded);
+	double clusteredImbalance = clusteredShards.getImbalance();
+	std::cout << "Clustered sharded octree imbalance " << clusteredImbalance << " over shards of";
+	for (int s = 0; s < 4; s++) { std::cout << " " << clusteredShards.getShardSize(s); }
+	std::cout << " particles." << std::endl;
+	clusteredShards.close();
+	delete[] shardedList;
+	if (!clusteredBuilt || clusteredImbalance > 1.5) {
+		std::cout << "Clustered shards are not balanced." << std::endl;
+		return 1;
+	}
+	// Build each half of the particles as a separate worker's octree, then merge them node by node
+	// The array is still in the sheet octree's leaf order, so the halves barely overlap and most subtrees are spliced whole
+	int half = numParts / 2;
+	Octree<vec3>* mergedOctree = new Octree<vec3>(particleList, vec3Coords, half, 8, 16, 0, 1, 0, 1, 0, 1);
+	Octree<vec3>* workerOctree = new Octree<vec3>(particleList + half, vec3Coords, numParts - half, 8, 16, 0, 1, 0, 1, 0, 1);
+	auto t0z = std::chrono::high_resolution_clock::now();
+	mergedOctree->merge(std::move(*workerOctree));
+	auto t0za = std::chrono::high_resolution_clock::now();
+	std::cout << "Octree merge time: " << std::chrono::duration_cast<std::chrono::microseconds>(t0za - t0z).count() << "us, merged root has " << mergedOctree->getRoot()->num_
+		<< " particles in " << mergedOctree->stats().numLeaves_ << " leaves, worker root has " << workerOctree->getRoot()->num_ << "." << std::endl;
+	// The merged tree must match a single build of all the particles, leaf for leaf
+	Octree<vec3>* singleOctree = new Octree<vec3>(particleList, vec3Coords, numParts, 8, 16, 0, 1, 0, 1, 0, 1);
+	Octree<vec3>::OctreeStats mergedStats = mergedOctree->stats(), singleStats = singleOctree->stats();
+	int unmatched = (mergedStats.nodesByDepth_ != singleStats.nodesByDepth_) + (mergedStats.leafOccupancy_ != singleStats.leafOccupancy_) + (mergedStats.numObjs_ != singleStats.numObjs_);
+	for (int i = 0; i < numParts; i++) {
+		Node<vec3>* leaf = mergedOctree->findLeafNode(particleList[i].x_, particleList[i].y_, particleList[i].z_);
+		Node<vec3>* single = singleOctree->findLeafNode(particleList[i].x_, particleList[i].y_, particleList[i].z_);
+		unmatched += !leaf || !single || leaf->num_ != single->num_ || leaf->xMin_ != single->xMin_ || leaf->yMin_ != single->yMin_ || leaf->zMin_ != single->zMin_ || leaf->depth_ != single->depth_;
+	}
+	delete singleOctree;
+	if (unmatched > 0 || workerOctree->getRoot()->num_ != 0) {
+		std::cout << unmatched << " differences between the merged octree and a single build." << std::endl;
+		return 1;
+	}
+	delete workerOctree;
+	delete mergedOctree;
+	// Give each particle a small box, and find every overlapping pair with a parallel traversal of the loose octree
+	Octree<vec3>* boxOctree = new Octree<vec3>(particleList, vec3Box, numParts, 8, 16, 0, 1, 0, 1, 0, 1);
+	auto t0zb = std::chrono::high_resolution_clock::now();
+	std::vector<std::pair<vec3*, vec3*>> collisions = boxOctree->collidePairs();
+	auto t0zc = std::chrono::high_resolution_clock::now();
+	std::cout << "Broad phase collision time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0zc - t0zb).count() << "ms, " << collisions.size() << " overlapping pairs." << std::endl;
+	// Cast line of sight rays from the centre, stopping each at the first leaf with a particle within 0.0002 of the ray, one at a time and as 8 ray packets
+	int numRays = 8000;
+	vec3* rayDirs = new vec3[numRays];
+	std::normal_distribution<> gauss(0, 1);
+	for (int i = 0; i < numRays; i += 8) {  // each packet jitters one direction, so its rays stay coherent
+		vec3 axis{ gauss(gen), gauss(gen), gauss(gen) };
+		for (int l = 0; l < 8; l++) {
+			vec3 d = axis + vec3{ gauss(gen), gauss(gen), gauss(gen) } * 0.01;
+			rayDirs[i + l] = d / std::sqrt(d.x_ * d.x_ + d.y_ * d.y_ + d.z_ * d.z_);
+		}
+	}
+	vec3 eye{ 0.5, 0.5, 0.5 };
+	auto blocks = [&](const vec3& d, Node<vec3>* leaf, double tEnter, double tExit) {
+		for (int j = 0; j < leaf->num_; j++) {
+			vec3 p = leaf->Objs_[j] - eye;
+			double t = p.x_ * d.x_ + p.y_ * d.y_ + p.z_ * d.z_;
+			vec3 off = p - d * t;
+			if (t >= tEnter && t <= tExit && off.x_ * off.x_ + off.y_ * off.y_ + off.z_ * off.z_ < 0.0002 * 0.0002) { return true; }
+		}
+		return false;
+	};
+	int blocked = 0, packetBlocked = 0;
+	auto t0zd = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < numRays; i++) {
+		blocked += boxOctree->raycast(eye, rayDirs[i], 1, [&](Node<vec3>* leaf, double tEnter, double tExit) { return blocks(rayDirs[i], leaf, tEnter, tExit); }) != nullptr;
+	}
+	auto t0ze = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < numRays; i += 8) {
+		vec3 eyes[8] = { eye, eye, eye, eye, eye, eye, eye, eye };
+		double tmax[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+		uint8_t stopped = boxOctree->raycast8(eyes, rayDirs + i, tmax, [&](int l, Node<vec3>* leaf, double tEnter, double tExit) { return blocks(rayDirs[i + l], leaf, tEnter, tExit); });
+		packetBlocked += std::popcount(stopped);
+	}
+	auto t0zf = std::chrono::high_resolution_clock::now();
+	std::cout << "Raycast time: " << std::chrono::duration_cast<std::chrono::microseconds>(t0ze - t0zd).count() << "us one at a time, " << std::chrono::duration_cast<std::chrono::microseconds>(t0zf - t0ze).count()
+		<< "us as packets, " << blocked << " and " << packetBlocked << " of " << numRays << " rays blocked." << std::endl;
+	// Packets of rays from different origins and directions must stop each lane at the same leaf as a single ray, here the first leaf with any particles, and visit it no further
+	int packetMismatched = 0, lateVisits = 0;
+	for (int k = 0; k < numRays / 8; k++) {
+		vec3 eyes[8], mixedDirs[8];
+		for (int l = 0; l < 8; l++) {
+			eyes[l] = vec3{ uni(gen), uni(gen), uni(gen) };
+			mixedDirs[l] = rayDirs[l * (numRays / 8) + k];
+		}
+		double tmax[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+		Node<vec3>* firstStop[8] = {};
+		boxOctree->raycast8(eyes, mixedDirs, tmax, [&](int l, Node<vec3>* leaf, double, double) {
+			lateVisits += firstStop[l] != nullptr;
+			firstStop[l] = leaf;
+			return true;
+		});
+		for (int l = 0; l < 8; l++) {
+			packetMismatched += firstStop[l] != boxOctree->raycast(eyes[l], mixedDirs[l], 1, [](Node<vec3>*, double, double) { return true; });
+		}
+	}
+	if (packetMismatched > 0 || lateVisits > 0 || packetBlocked != blocked) {
+		std::cout << packetMismatched << " rays in mixed direction packets stopped at a different leaf, " << lateVisits << " visits after a lane stopped." << std::endl;
+		return 1;
+	}
+	delete[] rayDirs;
+	// Cull the particles to a view frustum looking along z from below the box, taking inside nodes whole and testing particles in crossing leaves
+	vec3 camera{ 0.5, 0.5, -0.5 };
+	auto planeAt = [](const vec3& normal, const vec3& point) { return plane3{ normal, -(normal.x_ * point.x_ + normal.y_ * point.y_ + normal.z_ * point.z_) }; };
+	plane3 frustum[6] = { planeAt(vec3{ 0, 0, 1 }, vec3{ 0, 0, 0.2 }), planeAt(vec3{ 0, 0, -1 }, vec3{ 0, 0, 0.8 }),  // near and far
+		planeAt(vec3{ 1, 0, 0.3 }, camera), planeAt(vec3{ -1, 0, 0.3 }, camera), planeAt(vec3{ 0, 1, 0.3 }, camera), planeAt(vec3{ 0, -1, 0.3 }, camera) };
+	int insideNodes = 0, visible = 0;
+	auto t0zg = std::chrono::high_resolution_clock::now();
+	bool culled = boxOctree->cullFrustum(frustum, [&](Node<vec3>* node, bool inside) {
+		if (inside) { insideNodes++; visible += node->num_; return; }
+		for (int j = 0; j < node->num_; j++) {
+			bool seen = true;
+			for (const plane3& plane : frustum) { seen = seen && plane.distance(node->Objs_[j]) >= 0; }
+			visible += seen;
+		}
+	});
+	auto t0zh = std::chrono::high_resolution_clock::now();
+	std::cout << "Frustum cull time: " << std::chrono::duration_cast<std::chrono::microseconds>(t0zh - t0zg).count() << "us, " << insideNodes << " nodes inside, " << visible << " particles visible." << std::endl;
+	std::vector<plane3> tooMany(33, frustum[0]);
+	int tooManyVisited = 0;
+	if (!culled || boxOctree->cullFrustum(tooMany.data(), (int)tooMany.size(), [&](Node<vec3>*, bool) { tooManyVisited++; }) || tooManyVisited > 0) {
+		std::cout << "Frustum cull accepted more than 32 planes or rejected 6." << std::endl;
+		return 1;
+	}
+	// Extract a level of detail cut for the same camera, each node standing in for its particles once it looks small enough from the camera
+	auto looksSmall = [&](const Node<vec3>* node) {
+		double dx = node->x_ - camera.x_, dy = node->y_ - camera.y_, dz = node->z_ - camera.z_;
+		return node->getXLength() < 0.3 * std::sqrt(dx * dx + dy * dy + dz * dz);
+	};
+	auto t0zi = std::chrono::high_resolution_clock::now();
+	std::vector<Octree<vec3>::CutNode> cut = boxOctree->extractCut(looksSmall);
+	auto t0zj = std::chrono::high_resolution_clock::now();
+	long long cutWeight = 0;
+	for (const Octree<vec3>::CutNode& rep : cut) { cutWeight += rep.weight_; }
+	std::cout << "Level of detail cut time: " << std::chrono::duration_cast<std::chrono::microseconds>(t0zj - t0zi).count() << "us, " << cut.size() << " representatives weighing " << cutWeight << " particles." << std::endl;
+	// Every particle must be below exactly one representative, each internal representative must stop and none of their ancestors may
+	std::vector<const Node<vec3>*> cutNodes;
+	int badCut = 0;
+	for (const Octree<vec3>::CutNode& rep : cut) {
+		cutNodes.push_back(rep.node_);
+		badCut += rep.weight_ != rep.node_->num_ || rep.node_->num_ == 0 || (rep.node_->hasChildren() && !looksSmall(rep.node_));
+		for (const Node<vec3>* above = rep.node_->parent_; above; above = above->parent_) { badCut += looksSmall(above); }
+	}
+	std::sort(cutNodes.begin(), cutNodes.end());
+	for (int i = 0; i < numParts; i++) {
+		int covering = 0;
+		for (const Node<vec3>* node = boxOctree->findLeafNode(particleList[i].x_, particleList[i].y_, particleList[i].z_); node; node = node->parent_) {
+			covering += std::binary_search(cutNodes.begin(), cutNodes.end(), node);
+		}
+		badCut += covering != 1;
+	}
+	if (badCut > 0 || cutWeight != boxOctree->getRoot()->num_) {
+		std::cout << badCut << " particles or representatives wrongly covered by the level of detail cut." << std::endl;
+		return 1;
+	}
+	// Assign a new set of particles to the leaves holding them in random order, by descending from the root and then through the hashed cell key table
+	vec3* assignList = new vec3[numParts];
+	for (int i = 0; i < numParts; i++) {  // drawn from the same distribution as the particles, crowded towards x = 0
+		double x = uni(gen);
+		assignList[i] = vec3{ x * x * x, uni(gen), uni(gen) };
+	}
+	auto t0zk = std::chrono::high_resolution_clock::now();
+	int descended = 0;
+	for (int i = 0; i < numParts; i++) { descended += boxOctree->findLeafNode(assignList[i].x_, assignList[i].y_, assignList[i].z_) != nullptr; }
+	auto t0zl = std::chrono::high_resolution_clock::now();
+	bool tableBuilt = boxOctree->buildNodeTable();
+	auto t0zm = std::chrono::high_resolution_clock::now();
+	int hashed = 0;
+	for (int i = 0; i < numParts; i++) { hashed += boxOctree->lookupLeaf(assignList[i]) != nullptr; }
+	auto t0zn = std::chrono::high_resolution_clock::now();
+	int mismatched = 0;
+	for (int i = 0; i < numParts; i++) { mismatched += boxOctree->lookupLeaf(assignList[i]) != boxOctree->findLeafNode(assignList[i].x_, assignList[i].y_, assignList[i].z_); }
+	std::cout << "Leaf assignment time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0zl - t0zk).count() << "ms descending, " << std::chrono::duration_cast<std::chrono::milliseconds>(t0zn - t0zm).count()
+		<< "ms through the node table (built in " << std::chrono::duration_cast<std::chrono::milliseconds>(t0zm - t0zl).count() << "ms), " << descended << " and " << hashed << " particles in non-empty regions." << std::endl;
+	// Move the tree and query the moved-to tree, its box function and node table come with it and the source is left empty
+	auto t0zo = std::chrono::high_resolution_clock::now();
+	if (!tableBuilt || mismatched > 0) {
+		std::cout << mismatched << " particles were assigned a different leaf through the node table." << std::endl;
+		return 1;
+	}
+	Octree<vec3> movedOctree(std::move(*boxOctree));
+	int movedHashed = 0;
+	for (int i = 0; i < numParts; i++) { movedHashed += movedOctree.lookupLeaf(assignList[i]) != nullptr; }
+	size_t movedCollisions = movedOctree.collidePairs().size();
+	auto t0zp = std::chrono::high_resolution_clock::now();
+	std::cout << "Moved octree query time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t0zp - t0zo).count() << "ms, " << movedHashed << " particles in non-empty regions, " << movedCollisions << " colliding pairs." << std::endl;
+	if (movedHashed != hashed || movedCollisions != collisions.size() || boxOctree->getRoot()->num_ != 0 || boxOctree->getRoot()->hasChildren()) {
+		std::cout << "Moved octree does not match the original." << std::endl;
+		return 1;
+	}
+	// Changing the tree drops the node table, so lookups miss until it is rebuilt rather than reaching freed nodes
+	for (int i = 0; i < numParts / 10; i++) { movedOctree.stage(assignList[i]); }
+	movedOctree.flush();
+	int staleHits = 0;
+	for (int i = 0; i < numParts; i++) { staleHits += movedOctree.lookupLeaf(assignList[i]) != nullptr; }
+	movedOctree.buildNodeTable();
+	vec3* lostBoxes = movedOctree.parallelUpdateTree();
+	if (lostBoxes) { delete[] lostBoxes; }
+	for (int i = 0; i < numParts; i++) { staleHits += movedOctree.lookupLeaf(assignList[i]) != nullptr; }
+	movedOctree.buildNodeTable();
+	int rebuiltMismatched = 0;
+	for (int i = 0; i < numParts; i++) { rebuiltMismatched += movedOctree.lookupLeaf(assignList[i]) != movedOctree.findLeafNode(assignList[i].x_, assignList[i].y_, assignList[i].z_); }
+	if (staleHits > 0 || rebuiltMismatched > 0) {
+		std::cout << staleHits << " lookups through a stale node table, " << rebuiltMismatched << " mismatched after rebuilding it." << std::endl;
+		return 1;
+	}
+	delete[] assignList;
+	delete boxOctree;
 	// Memory cleanup
 	delete octree3;
 	for (int i = 0; i < numParts; i++) {
@@ -142,12 +522,73 @@ int main() {
 	auto t8 = std::chrono::high_resolution_clock::now();
 	std::cout << "Octree update time with massive particle changes: " << std::chrono::duration_cast<std::chrono::milliseconds>(t8 - t7).count() << "ms" << std::endl;
 
+	// Regenerate particle positions again, and update octree over disjoint subtrees in parallel
+	for (int i = 0; i < numParts; i++) {
+		particles[i].get()->x_ = uni(gen);
+		particles[i].get()->y_ = uni(gen);
+		particles[i].get()->z_ = uni(gen);
+	}
+	auto t7p = std::chrono::high_resolution_clock::now();
+	std::shared_ptr<vec3>* lostObjs3 = octree->parallelUpdateTree();
+	auto t8p = std::chrono::high_resolution_clock::now();
+	std::cout << "Parallel octree update time with massive particle changes: " << std::chrono::duration_cast<std::chrono::milliseconds>(t8p - t7p).count() << "ms" << std::endl;
+	if (lostObjs3) { delete[] lostObjs3; }
+
+	// Nudge every particle slightly, and refit the octree without changing its topology
+	for (int i = 0; i < numParts; i++) {
+		particles[i].get()->x_ += 0.0001;
+	}
+	auto t7r = std::chrono::high_resolution_clock::now();
+	Octree<std::shared_ptr<vec3>>::RefitQuality quality = octree->refit();
+	auto t8r = std::chrono::high_resolution_clock::now();
+	std::cout << "Octree refit time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t8r - t7r).count() << "ms" << std::endl;
+	std::cout << quality.misplaced_ << " particles outside their leaf after refit (" << quality.misplacedFraction_ * 100 << "%)." << std::endl;
+
+	// Let the octree choose between refit, update and rebuild
+	for (int i = 0; i < numParts / 10; i++) {
+		particles[i].get()->y_ = uni(gen);
+	}
+	std::shared_ptr<vec3>* lostObjs4 = octree->synchronize();
+	const char* actions[] = { "refit", "update", "rebuild" };
+	std::cout << "Octree synchronize chose " << actions[(int)octree->getLastSync().action_] << " for an estimated " << octree->getLastSync().displacedFraction_ * 100
+		<< "% displaced particles, taking " << octree->getLastSync().actionTime_ * 1000 << "ms" << std::endl;
+	if (lostObjs4) { delete[] lostObjs4; }
+
+	// Snapshot the octree with a structural copy, as for a rollback point
+	auto t8s = std::chrono::high_resolution_clock::now();
+	Octree<std::shared_ptr<vec3>>* snapshot = new Octree<std::shared_ptr<vec3>>(*octree);
+	auto t9s = std::chrono::high_resolution_clock::now();
+	std::cout << "Octree copy time: " << std::chrono::duration_cast<std::chrono::milliseconds>(t9s - t8s).count() << "ms, snapshot has "
+		<< snapshot->getDataSize(snapshot->getRoot()) << " particles." << std::endl;
+	// The snapshot must have the same shape, with every particle in an equal leaf of its own nodes
+	Octree<std::shared_ptr<vec3>>::OctreeStats originalStats = octree->stats(), snapshotStats = snapshot->stats();
+	int differing = (originalStats.nodesByDepth_ != snapshotStats.nodesByDepth_) + (originalStats.leafOccupancy_ != snapshotStats.leafOccupancy_) + (originalStats.numObjs_ != snapshotStats.numObjs_);
+	for (int i = 0; i < numParts; i++) {
+		vec3 V = *particles[i];
+		Node<std::shared_ptr<vec3>>* leaf = octree->findLeafNode(V.x_, V.y_, V.z_);
+		Node<std::shared_ptr<vec3>>* copied = snapshot->findLeafNode(V.x_, V.y_, V.z_);
+		if (!leaf || !copied) { differing += leaf != copied; continue; }
+		bool same = leaf != copied && leaf->num_ == copied->num_ && leaf->xMin_ == copied->xMin_ && leaf->xMax_ == copied->xMax_ && leaf->yMin_ == copied->yMin_ && leaf->yMax_ == copied->yMax_ && leaf->zMin_ == copied->zMin_ && leaf->zMax_ == copied->zMax_;
+		for (int j = 0; same && j < leaf->num_; j++) { same = leaf->Objs_[j] == copied->Objs_[j]; }
+		differing += !same;
+	}
+	if (differing > 0) {
+		std::cout << differing << " differences between the snapshot and the original octree." << std::endl;
+		return 1;
+	}
+	delete snapshot;
+
 	// Destroy and rebuild octree entirely
 	auto t9 = std::chrono::high_resolution_clock::now();
 	delete octree;
 	Octree<std::shared_ptr<vec3>>* octree2 = new Octree<std::shared_ptr<vec3>>(particles, vec3SmrtPntrCoords, numParts, 3, 16, 0, 1, 0, 1, 0, 1);
 	auto t10 = std::chrono::high_resolution_clock::now();
 	std::cout << "Time to destroy and rebuild octree (with data already retrieved): " << std::chrono::duration_cast<std::chrono::milliseconds>(t10 - t9).count() << "ms" << std::endl;
+	// Tree shape and memory use
+	Octree<std::shared_ptr<vec3>>::OctreeStats stats = octree2->stats();
+	std::cout << "Octree stats: " << stats.numNodes_ << " nodes (" << stats.numInternal_ << " internal, " << stats.numLeaves_ << " leaves, " << stats.numEmpty_ << " empty), "
+		<< stats.nodeBytes_ / 1024 << "KB in nodes, " << stats.objBytes_ / 1024 << "KB in objects, " << stats.slackBytes_ / 1024 << "KB slack, max depth "
+		<< stats.maxDepth_ << ", mean leaf depth " << stats.meanLeafDepth_ << ", " << stats.leafOccupancy_.back() << " overfull leaves." << std::endl;
 	std::cout << octree2->getRoot()->xMin_ << ", " << octree2->getRoot()->xMax_ << std::endl;
 
 	// Make a new particle in the box limits and add it
@@ -160,6 +601,32 @@ int main() {
 	auto t12 = std::chrono::high_resolution_clock::now();
 	std::cout << "Time to add particle inside octree bounds (in microseconds): " << std::chrono::duration_cast<std::chrono::microseconds>(t12 - t11).count() << "us" << std::endl;
 
+	// Stage a burst of new particles inside the box limits and flush them together
+	for (int i = 0; i < 10000; i++) {
+		octree2->stage(std::shared_ptr<vec3>(new vec3{ uni(gen), uni(gen), uni(gen) }));
+	}
+	auto t12a = std::chrono::high_resolution_clock::now();
+	octree2->flush();
+	auto t12b = std::chrono::high_resolution_clock::now();
+	std::cout << "Time to flush 10000 staged particles inside octree bounds: " << std::chrono::duration_cast<std::chrono::milliseconds>(t12b - t12a).count() << "ms" << std::endl;
+
+	// Insert particles from several threads at once, then consolidate them into the tree
+	auto t12c = std::chrono::high_resolution_clock::now();
+	std::vector<std::thread> producers;
+	for (int t = 0; t < 4; t++) {
+		producers.emplace_back([octree2, t]() {
+			std::mt19937 producerGen(t);
+			std::uniform_real_distribution<> producerUni(0, 1);
+			for (int i = 0; i < 2500; i++) {
+				octree2->concurrentInsert(std::shared_ptr<vec3>(new vec3{ producerUni(producerGen), producerUni(producerGen), producerUni(producerGen) }));
+			}
+		});
+	}
+	for (std::thread& producer : producers) { producer.join(); }
+	octree2->consolidate();
+	auto t12d = std::chrono::high_resolution_clock::now();
+	std::cout << "Time to insert 10000 particles from 4 threads and consolidate: " << std::chrono::duration_cast<std::chrono::milliseconds>(t12d - t12c).count() << "ms" << std::endl;
+
 	// Make a new particle outside the box limits and add it (should be == destroy+rebuild)
 	std::shared_ptr<vec3> newParticle2(new vec3{ 1.1, 1.1, 1.1 });
 	auto t13 = std::chrono::high_resolution_clock::now();
@@ -171,6 +638,33 @@ int main() {
 	std::cout << octree2->getDataSize(octree2->getRoot()->child_[0]) << std::endl;
 	std::cout << octree2->getRoot()->xMin_ << ", " << octree2->getRoot()->xMax_ << std::endl;
 
+	// Read a double buffered octree from another thread while this thread writes and publishes new versions
+	std::shared_ptr<vec3>* versionParticles = octree2->copyTreeData(octree2->getRoot());
+	int versionNum = octree2->getRoot()->num_;
+	DoubleBufferedOctree<std::shared_ptr<vec3>> versioned(versionParticles, vec3SmrtPntrCoords, versionNum, 3, 16);
+	std::atomic<bool> writing(true);
+	std::atomic<int> snapshotsRead(0);
+	std::thread reader([&]() {
+		while (writing) {
+			auto snapshot = versioned.pin();  // no locks while reading the snapshot
+			if (snapshot->getDataSize(snapshot->getRoot()) == snapshot->getRoot()->num_) { snapshotsRead++; }
+		}
+	});
+	auto t15 = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < 5; i++) {
+		Octree<std::shared_ptr<vec3>>& writeTree = versioned.beginWrite();
+		writeTree.addToTree(std::shared_ptr<vec3>(new vec3{ uni(gen), uni(gen), uni(gen) }));
+		versioned.publish();
+		versioned.reclaim();
+	}
+	auto t16 = std::chrono::high_resolution_clock::now();
+	writing = false;
+	reader.join();
+	std::cout << "Time to write and publish 5 octree versions: " << std::chrono::duration_cast<std::chrono::milliseconds>(t16 - t15).count() << "ms, "
+		<< snapshotsRead << " consistent snapshots read meanwhile." << std::endl;
+	std::cout << "Latest version has " << versioned.pin()->getRoot()->num_ << " particles." << std::endl;
+	delete[] versionParticles;
+
 	delete octree2;
 	newParticle1.reset();
 	newParticle2.reset();